@@ -1,16 +1,44 @@
+#include <algorithm>
+#include <chrono>
+#include <deque>
 #include <fstream>
+#include <functional>
+#include <sstream>
 #include <string>
+#include <thread>
+#include <unordered_map>
+#include <limits>
+#include <map>
+#include <numeric>
+#include <set>
+#include <tuple>
+#include <poll.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
 #include "ns3/core-module.h"
 #include "ns3/network-module.h"
 #include "ns3/internet-module.h"
 #include "ns3/point-to-point-module.h"
 #include "ns3/applications-module.h"
 #include "ns3/ipv4-global-routing-helper.h"
+#include "ns3/ipv4-static-routing-helper.h"
+#include "ns3/nix-vector-helper.h"
 #include "ns3/netanim-module.h"
 #include "ns3/flow-monitor-module.h"
 #include "ns3/traffic-control-module.h"
 #include "ns3/uinteger.h"
 #include <iostream>
+#include <sqlite3.h>
+// ns-3 only builds ns3::Version when configured with --enable-build-version
+#if __has_include("ns3/version.h")
+#include "ns3/version.h"
+#define HAVE_NS3_VERSION
+#endif
+#ifdef NS3_MPI
+#include "ns3/mpi-interface.h"
+#include <mpi.h>
+#endif
 
 using namespace ns3;
 
@@ -18,419 +46,3862 @@ NS_LOG_COMPONENT_DEFINE("ns3simulator");
 
 NodeContainer source, destination, router;
 
-// We set a flow time of 120 seconds, to ensure that all experiments have enough time to completely transfer the data
-double flow_time = 120.0;
-double start_time = 0.0;
-int d1_port = 8331, d2_port = 8332;
+// RED queue discs watched by the tracing: both directions of the bottleneck between the routers of the
+// dumbbell, the last hop towards every receiver in the fabrics
+QueueDiscContainer bottleneck_queues;
 
-// Set max bytes to 50 MB
-uint maxBytes = 50 * 1024 * 1024;
+// RED queue discs on every switch egress
+QueueDiscContainer switch_queues;
 
-float calculate_sd(float a, float b, float c) {
-    float mean = (a + b + c) / 3;
-    float summation = pow(a - mean, 2) + pow(b - mean, 2) + pow(c - mean, 2);
-    float sd = sqrt(summation / 3);
-    return sd;
+// Shape of the network built for every cell: dumbbell, leafspine or fattree
+std::string topology = "dumbbell";
+
+// Switch radix of the leaf-spine and fat-tree fabrics
+uint32_t fabric_k = 4;
+
+// Sending and receiving hosts, flows in the spec refer to them as s1..sN and d1..dN.
+// Set on the command line for the dumbbell and derived from fabric_k for the fabrics.
+uint32_t num_sources = 2, num_destinations = 2;
+
+// Port of the sink on every receiver. The flows of an experiment send from the following ports, one
+// each, which tells them apart at the shared sink.
+uint16_t base_port = 8331;
+
+// Routes of the network: global (ns-3 global routing, the first of equal-cost paths), static (shortest
+// paths precomputed here and spread over equal-cost paths by destination) or nix (Nix-vector routing,
+// each path computed when first used)
+std::string routing = "global";
+
+// Base seed for RngSeedManager, each run of an experiment uses its own run number
+uint32_t seed = 1;
+
+// Number of cells simulated at the same time, defaults to all local cores
+uint32_t workers = std::thread::hardware_concurrency();
+
+// Distributed simulation: every cell is split across the MPI ranks started by mpirun, which simulate
+// the cells one after the other. mpi_rank is the rank of this process.
+bool mpi = false;
+uint32_t mpi_rank = 0, mpi_size = 1;
+
+// Simulated time at which every rank of a distributed cell stops, derived from the flows of the cell when 0
+Time mpi_stop_time;
+
+// Adaptive replication: runs of an experiment are added until the 95% confidence interval of every
+// metric is narrower than ci_target times its mean, between min_runs and max_runs runs
+bool adaptive = false;
+uint32_t min_runs = 2, max_runs = 30;
+double ci_target = 0.01;
+
+// Set max bytes to 50 MB, used by every flow that does not give its own size in the spec
+uint64_t maxBytes = 50 * 1024 * 1024;
+
+// Queue disc on every switch egress and the DCTCP response to its marks. disc is red (the defaults are
+// explained in the README), step (DCTCP-style marking of every packet above k packets), fqcodel or pie
+// (target and interval are ns-3 times such as 5ms, pie only uses target).
+struct AqmSpec {
+    std::string disc = "red";
+    double min_th = 20;
+    double max_th = 60;
+    double qw = 0.0625;
+    uint32_t max_size = 200;
+    double k = 20;
+    std::string target = "5ms";
+    std::string interval = "100ms";
+    double dctcp_g = 0.0625;
+    double dctcp_alpha_init = 1.0;
+};
+
+// One bulk transfer from source[sender] to destination[receiver]
+struct FlowSpec {
+    uint32_t sender;
+    uint32_t receiver;
+    std::string tcp_variant;
+    uint64_t bytes;
+};
+
+// Poisson flow arrivals between random senders and receivers at a fraction of the bottleneck capacity,
+// with sizes drawn from an empirical CDF
+struct WorkloadSpec {
+    std::string tcp_variant;
+    double load = 0;
+    uint32_t flows = 0;
+    std::string cdf_name = "websearch";
+    std::vector<std::pair<double, double>> cdf;
+};
+
+// An experiment either runs its listed flows or a workload (flows of the workload is non-zero)
+struct ExperimentSpec {
+    std::string name;
+    uint32_t runs = 3;
+    AqmSpec aqm;
+    std::vector<FlowSpec> flows;
+    WorkloadSpec workload;
+
+    // Configuration of the AQM sweep this experiment belongs to, empty outside a sweep
+    std::string sweep_config;
+};
+
+// Experiment matrix, every (experiment, run) cell is simulated on its own topology in a separate worker process
+std::vector<ExperimentSpec> experiments;
+
+// The five experiments of the project, used when no spec file is given. Format:
+//   experiment <name> [runs=<n>] [<queue option>=<value> ...]
+//   flow s<sender> d<receiver> <TcpVariant> [bytes]
+//   workload <TcpVariant> load=<fraction> flows=<n> [cdf=websearch|datamining|<file>]
+const char* default_spec =
+    "experiment 1 runs=3\n"
+    "flow s1 d1 TcpBic\n"
+    "experiment 2 runs=3\n"
+    "flow s1 d1 TcpBic\n"
+    "flow s2 d2 TcpBic\n"
+    "experiment 3 runs=3\n"
+    "flow s1 d1 TcpDctcp\n"
+    "experiment 4 runs=3\n"
+    "flow s1 d1 TcpDctcp\n"
+    "flow s2 d2 TcpDctcp\n"
+    "experiment 5 runs=3\n"
+    "flow s1 d1 TcpBic\n"
+    "flow s2 d2 TcpDctcp\n";
+
+// Queue options of an experiment or a sweep configuration:
+//   aqm=red|step|fqcodel|pie minth=<packets> maxth=<packets> qw=<weight> maxsize=<packets> k=<packets>
+//   target=<time> interval=<time> dctcpg=<gain> dctcpalpha=<initial alpha>
+
+// Configurations of the AQM sweep, used with --sweep=default. Format: config <name> [<queue option> ...]
+const char* default_sweep =
+    "config red aqm=red\n"
+    "config red-10-30 aqm=red minth=10 maxth=30\n"
+    "config red-40-120 aqm=red minth=40 maxth=120\n"
+    "config red-qw0.002 aqm=red qw=0.002\n"
+    "config step-k10 aqm=step k=10\n"
+    "config step-k20 aqm=step k=20\n"
+    "config step-k40 aqm=step k=40\n"
+    "config step-k20-g0.03 aqm=step k=20 dctcpg=0.03125\n"
+    "config step-k20-g0.25 aqm=step k=20 dctcpg=0.25\n"
+    "config step-k20-alpha0 aqm=step k=20 dctcpalpha=0\n"
+    "config fqcodel aqm=fqcodel target=5ms interval=100ms\n"
+    "config fqcodel-dc aqm=fqcodel target=500us interval=10ms\n"
+    "config pie aqm=pie target=15ms\n"
+    "config pie-dc aqm=pie target=1ms\n";
+
+// Built-in flow-size distributions as "<bytes> <cumulative probability>" lines: web search from the
+// DCTCP paper and data mining from VL2, in the form used by pFabric. Both start with a point mass at their
+// smallest size (15% and 50% of the flows), a repeated size that cdf_sample does not interpolate below
+const char* websearch_cdf =
+    "10000 0\n10000 0.15\n20000 0.2\n30000 0.3\n50000 0.4\n80000 0.53\n200000 0.6\n"
+    "1000000 0.7\n2000000 0.8\n5000000 0.9\n10000000 0.97\n30000000 1\n";
+const char* datamining_cdf =
+    "1460 0\n1460 0.5\n2920 0.6\n4380 0.7\n10220 0.8\n389820 0.9\n3076220 0.95\n"
+    "97333820 0.99\n973333820 1\n";
+
+// Flow-size buckets of the FCT percentiles, a flow falls in the first bucket whose limit it does not exceed
+const uint64_t fct_bucket_limits[] = {10 * 1024, 100 * 1024, 1024 * 1024};
+const char* fct_bucket_names[] = {"0-10KB", "10KB-100KB", "100KB-1MB", "1MB+"};
+const size_t fct_buckets = 4;
+
+// Rate of every link, the workload load is relative to it
+std::string link_rate = "1Gbps";
+
+// TCP segment size (the ns-3 default) and the IP packet it makes with TCP timestamps
+const uint32_t segment_size = 536;
+const uint32_t packet_bytes = segment_size + 52;
+
+// Fast mode: senders send this many segments as one aggregate segment that the links serialize as one
+// packet, 1 simulates every packet
+uint32_t segment_aggregation = 1;
+
+// With aggregation the queue discs count bytes, without it packets
+bool queue_in_bytes() {
+    return segment_aggregation > 1;
+}
+
+// Name of the queue disc trace that follows its length in the unit of its thresholds
+const char* queue_length_trace() {
+    return queue_in_bytes() ? "BytesInQueue" : "PacketsInQueue";
+}
+
+// Record the queueing delay of every packet leaving a bottleneck queue
+bool queue_delay = true;
+
+// Dump the full FlowMonitor statistics of every cell as XML, off by default since it grows with the flow count
+bool flowmon_xml = false;
+
+// Per-flow counters of the running cell, filled from the BulkSend Tx and PacketSink Rx traces
+struct FlowRecord {
+    uint64_t target_bytes;
+    uint64_t tx_bytes;
+    uint64_t rx_bytes;
+    Time first_tx;
+    Time last_rx;
+    Ipv4FlowClassifier::FiveTuple tuple;
+    bool reported;
+};
+
+std::vector<FlowRecord> flows;
+size_t flows_done = 0;
+
+// Flows of the running cell, the simulation stops once all of them are done
+size_t flows_expected = 0;
+
+// Flows of the running cell by their source port, and the receivers that already run a sink for them
+std::map<uint16_t, size_t> flow_by_source_port;
+std::set<uint32_t> flow_sinks;
+
+// Persistent connection of the workload. Flows between the same two hosts are queued on an idle
+// connection and written to its socket in order, the sink splits the byte stream into flows by their sizes.
+struct WorkloadConnection {
+    Ptr<Socket> socket;
+    uint32_t sender;
+    uint32_t receiver;
+    Ipv4FlowClassifier::FiveTuple tuple;
+    bool connected;
+    std::deque<size_t> unsent;
+    std::deque<size_t> unreceived;
+};
+
+// Connections of the running cell, the idle ones of every sender/receiver pair, and every connection by
+// the address and port it is seen from at the sink
+std::vector<WorkloadConnection> connections;
+std::map<std::pair<uint32_t, uint32_t>, std::vector<size_t>> idle_connections;
+std::map<std::pair<uint32_t, uint16_t>, size_t> connection_by_source;
+
+const WorkloadSpec* workload = nullptr;
+std::vector<Ipv4Address> workload_receivers;
+Ptr<ExponentialRandomVariable> workload_interarrival;
+Ptr<UniformRandomVariable> workload_uniform;
+
+// Experiment and run of the cell simulated by this worker, and the pipe its finished flows are streamed to
+size_t cell_experiment = 0;
+uint32_t cell_run = 0;
+int report_fd = -1;
+
+// Longest queue seen on any switch in the running cell, in the unit of the queue discs (bytes with
+// aggregation, packets without). With RED nothing else in the
+// scenario is random, so a cell whose queues stay below MinTh gives the same result for every seed.
+uint32_t peak_queue = 0;
+
+// Experiments found to be seed-independent by the adaptive replication
+std::vector<bool> experiment_deterministic;
+
+// Finished flows streamed by the workers, one CSV line per flow
+std::string flows_file = "tcp_hchench_adlapp_flows.csv";
+
+// Results database, every finished cell is stored under the hash of its full configuration. Cells whose
+// hash is already stored are read back instead of simulated, unless rerun is set.
+std::string results_db = "tcp_hchench_adlapp.db";
+bool rerun = false;
+
+// Revision of the simulation model, part of the hash of every stored cell. Bump it with every change to this
+// program that changes the results of a cell, so stored cells of the old behavior are simulated again.
+const uint32_t model_revision = 3;
+
+// ns-3 release given on the command line, needed when ns-3 was built without --enable-build-version
+std::string ns3_release;
+sqlite3* db = nullptr;
+
+// Sampling interval of the time-series tracing, tracing is off (and costs nothing) when zero
+Time trace_interval;
+
+// Interval of the throughput samples behind the fairness metrics of experiments with several flows, off
+// when zero. A flow has converged once its interval throughput stays within convergence_band of the fair
+// share.
+Time fairness_interval = MilliSeconds(1);
+double convergence_band = 0.1;
+
+// Rows buffered per trace file before they are written out as one block
+const size_t trace_buffer_rows = 4096;
+
+// Column-major sample buffer of the running cell, allocated once when tracing starts. When all
+// trace_buffer_rows rows are used the buffer is written out as one block and filled again from row 0.
+struct TraceTable {
+    std::vector<std::string> columns;
+    std::vector<double> data;
+    size_t rows = 0;
+    std::ofstream file;
+};
+
+TraceTable trace_table;
+
+// Latest value of every traced series, copied into the table at each sample
+std::vector<double> trace_cwnd, trace_alpha;
+
+struct QueueTrace {
+    Ptr<QueueDisc> queue;
+    double avg;
+    uint32_t marks;
+    uint32_t drops;
+    // Packets per second the link sends at MeanPktSize, and when the queue last went idle
+    double ptc;
+    bool idle;
+    Time idle_since;
+};
+
+// Queues of the running cell and the weight of their RED average, NaN for the queue discs without one
+std::vector<QueueTrace> trace_queues;
+double trace_qw = 0;
+
+// Log-linear histogram of queueing delays in nanoseconds. Delays below 2^hist_sub_bits get a bucket each,
+// every higher power of two is split into 2^(hist_sub_bits - 1) equal buckets, so a bucket is within 1/64
+// of its delays. Delays of 2^hist_max_bits ns (about 18 minutes) and more share the last bucket.
+const int hist_sub_bits = 7;
+const int hist_max_bits = 40;
+const size_t hist_buckets = (hist_max_bits - hist_sub_bits + 2) << (hist_sub_bits - 1);
+
+struct DelayHistogram {
+    std::vector<uint64_t> counts;
+    uint64_t total = 0;
+    uint64_t max_ns = 0;
+};
+
+// One histogram per bottleneck queue and traffic class of the running cell, indexed
+// queue * delay_classes.size() + class. Packets are classed by the TCP variant of their sender, anything
+// not sent by a sender (ACKs on the way back) is in the last class.
+std::vector<DelayHistogram> delay_histograms;
+std::vector<std::string> delay_classes;
+std::unordered_map<uint32_t, size_t> delay_class_of;
+
+// Running mean and sum of squared deviations of one metric, updated one run at a time (Welford)
+struct RunningStats {
+    uint32_t n = 0;
+    double mean = 0;
+    double m2 = 0;
+};
+
+void running_add(RunningStats& stats, double value) {
+    stats.n++;
+    double delta = value - stats.mean;
+    stats.mean += delta / stats.n;
+    stats.m2 += delta * (value - stats.mean);
 }
 
-void data_transfer(Ptr<Node> src, Ptr<Node> dest, Address sinkAddress, uint16_t sinkPort, 
-                  std::string tcp_version, double start_time) {
+// Sample standard deviation, zero for a single run
+double running_sd(const RunningStats& stats) {
+    return stats.n > 1 ? sqrt(stats.m2 / (stats.n - 1)) : 0;
+}
 
-    // Dynamically configure TCP variant by setting the socket type on a specific node
-    std::string nodePath = "/NodeList/" + std::to_string(src->GetId()) + "/$ns3::TcpL4Protocol/SocketType";
+// Two-sided 95% quantile of Student's t distribution, rounded up between the tabulated degrees of freedom
+double t_quantile_95(uint32_t df) {
+    static const double table[] = {12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+                                   2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+                                   2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042};
+    if (df >= 1 && df <= 30) {
+        return table[df - 1];
+    }
+    return df <= 40 ? 2.042 : df <= 60 ? 2.021 : df <= 120 ? 2.000 : 1.980;
+}
 
-    if (tcp_version == "TcpBic") {
-        Config::Set(nodePath, TypeIdValue(TcpBic::GetTypeId()));
-    } else if (tcp_version == "TcpDctcp") {
-        Config::Set(nodePath, TypeIdValue(TcpDctcp::GetTypeId()));
+// Half-width of the 95% confidence interval of the mean, infinite until there are two runs
+double ci_half_width(const RunningStats& stats) {
+    if (stats.n < 2) {
+        return std::numeric_limits<double>::infinity();
     }
-  
-    double endtime = start_time + flow_time;
-    BulkSendHelper sourceHelper("ns3::TcpSocketFactory", sinkAddress);
+    return t_quantile_95(stats.n - 1) * running_sd(stats) / sqrt(stats.n);
+}
 
-    // MaxBytes ensures flow doesn't exceed the 50MB limit
-    sourceHelper.SetAttribute("MaxBytes", UintegerValue(maxBytes));
-    
-    PacketSinkHelper packetSinkHelper("ns3::TcpSocketFactory", 
-                                    InetSocketAddress(Ipv4Address::GetAny(), sinkPort));
-    ApplicationContainer dest_container = packetSinkHelper.Install(dest);
-    ApplicationContainer source_container = sourceHelper.Install(src);
+size_t hist_index(uint64_t ns) {
+    ns = std::min(ns, (uint64_t(1) << hist_max_bits) - 1);
+    if (ns < (1u << hist_sub_bits)) {
+        return ns;
+    }
+    int shift = 63 - __builtin_clzll(ns) - hist_sub_bits + 1;
+    return ((shift + 1) << (hist_sub_bits - 1)) + (ns >> shift) - (1u << (hist_sub_bits - 1));
+}
+
+// Largest delay that falls into the bucket
+uint64_t hist_value(size_t index) {
+    size_t half = 1u << (hist_sub_bits - 1);
+    if (index < 2 * half) {
+        return index;
+    }
+    int shift = index / half - 1;
+    return ((uint64_t)(index % half + half + 1) << shift) - 1;
+}
+
+// Smallest bucket value at or below which the fraction p of the delays lie, never above the largest delay
+uint64_t hist_percentile(const DelayHistogram& histogram, double p) {
+    uint64_t rank = std::max<uint64_t>(1, ceil(p * histogram.total));
+    uint64_t seen = 0;
+    for (size_t index = 0; index < histogram.counts.size(); index++) {
+        seen += histogram.counts[index];
+        if (seen >= rank) {
+            return std::min(hist_value(index), histogram.max_ns);
+        }
+    }
+    return histogram.max_ns;
+}
+
+// Percentile of sorted values, interpolating linearly between neighbouring runs
+double percentile(const std::vector<double>& sorted, double p) {
+    double rank = p / 100 * (sorted.size() - 1);
+    size_t lower = floor(rank);
+    size_t upper = std::min(lower + 1, sorted.size() - 1);
+    return sorted[lower] + (rank - lower) * (sorted[upper] - sorted[lower]);
+}
+
+std::vector<std::string> split_csv(const std::string& line) {
+    std::vector<std::string> fields;
+    std::istringstream in(line);
+    std::string field;
+    while (std::getline(in, field, ',')) {
+        fields.push_back(field);
+    }
+    return fields;
+}
+
+// Reads "<bytes> <cumulative probability>" points, sizes and probabilities must not decrease and the
+// last probability must be 1
+std::vector<std::pair<double, double>> read_cdf(std::istream& in, const std::string& name) {
+    std::vector<std::pair<double, double>> cdf;
+    double bytes, probability;
+    while (in >> bytes >> probability) {
+        NS_ABORT_MSG_IF(!cdf.empty() && (bytes < cdf.back().first || probability < cdf.back().second),
+                        "Flow size CDF " << name << " is not increasing");
+        cdf.push_back({bytes, probability});
+    }
+    NS_ABORT_MSG_IF(!in.eof(), "Flow size CDF " << name << ": bad value after " << cdf.size() << " points");
+    NS_ABORT_MSG_IF(cdf.empty() || cdf.back().second != 1, "Flow size CDF " << name << " does not end at 1");
+    return cdf;
+}
+
+std::vector<std::pair<double, double>> load_cdf(const std::string& name) {
+    if (name == "websearch" || name == "datamining") {
+        std::istringstream in(name == "websearch" ? websearch_cdf : datamining_cdf);
+        return read_cdf(in, name);
+    }
+    std::ifstream in(name);
+    NS_ABORT_MSG_IF(!in, "Cannot open flow size CDF " << name);
+    return read_cdf(in, name);
+}
+
+// Flow size at cumulative probability u, interpolating linearly between the points
+double cdf_sample(const std::vector<std::pair<double, double>>& cdf, double u) {
+    auto it = std::lower_bound(cdf.begin(), cdf.end(), u, [](const std::pair<double, double>& point, double p) {
+        return point.second < p;
+    });
+    if (it == cdf.begin()) {
+        return it->first;
+    }
+    auto prev = it - 1;
+    return prev->first + (u - prev->second) / (it->second - prev->second) * (it->first - prev->first);
+}
+
+// Mean flow size of the piecewise linear CDF
+double cdf_mean(const std::vector<std::pair<double, double>>& cdf) {
+    double mean = 0;
+    for (size_t i = 1; i < cdf.size(); i++) {
+        mean += (cdf[i].second - cdf[i - 1].second) * (cdf[i].first + cdf[i - 1].first) / 2;
+    }
+    return mean;
+}
+
+size_t fct_bucket(uint64_t bytes) {
+    size_t bucket = 0;
+    while (bucket < fct_buckets - 1 && bytes > fct_bucket_limits[bucket]) {
+        bucket++;
+    }
+    return bucket;
+}
+
+// Numeric values of the spec, the whole token has to be a finite number. where names the spec line or
+// sweep entry in errors.
+double parse_number(const std::string& token, const std::string& what, const std::string& where) {
+    size_t used = 0;
+    double value = 0;
+    try {
+        value = std::stod(token, &used);
+    } catch (const std::exception&) {
+        used = 0;
+    }
+    NS_ABORT_MSG_IF(used == 0 || used != token.size() || !std::isfinite(value),
+                    where << ": " << what << " is not a number: " << token);
+    return value;
+}
+
+uint64_t parse_count(const std::string& token, const std::string& what, const std::string& where,
+                     uint64_t max = std::numeric_limits<uint32_t>::max()) {
+    uint64_t value = 0;
+    bool valid = !token.empty() && token.size() <= 20 &&
+                 std::all_of(token.begin(), token.end(), [](char c) { return c >= '0' && c <= '9'; });
+    try {
+        value = valid ? std::stoull(token) : 0;
+    } catch (const std::out_of_range&) {
+        valid = false;
+    }
+    NS_ABORT_MSG_IF(!valid || value > max, where << ": " << what << " is not a count up to " << max << ": " << token);
+    return value;
+}
+
+// Times of the spec in the form ns-3 reads them: a positive number and a unit, seconds without one. Checked
+// here since ns-3 only rejects a bad time when the queue disc is built, inside a worker.
+std::string parse_time(const std::string& token, const std::string& what, const std::string& where) {
+    static const std::set<std::string> units = {"", "y", "d", "h", "min", "s", "ms", "us", "ns", "ps", "fs"};
+    size_t used = 0;
+    double value = 0;
+    try {
+        value = std::stod(token, &used);
+    } catch (const std::exception&) {
+        used = 0;
+    }
+    NS_ABORT_MSG_IF(used == 0 || units.count(token.substr(used)) == 0 || !std::isfinite(value) || value <= 0,
+                    where << ": " << what << " is not a positive time such as 5ms: " << token);
+    return token;
+}
+
+// Applies one queue option, returns false for keys that are not queue options
+bool parse_aqm_option(AqmSpec& aqm, const std::string& key, const std::string& value, const std::string& where) {
+    if (key == "aqm") {
+        NS_ABORT_MSG_IF(value != "red" && value != "step" && value != "fqcodel" && value != "pie",
+                        where << ": unknown queue disc " << value);
+        aqm.disc = value;
+    } else if (key == "minth") {
+        aqm.min_th = parse_number(value, key, where);
+    } else if (key == "maxth") {
+        aqm.max_th = parse_number(value, key, where);
+    } else if (key == "qw") {
+        aqm.qw = parse_number(value, key, where);
+    } else if (key == "maxsize") {
+        aqm.max_size = parse_count(value, key, where);
+    } else if (key == "k") {
+        aqm.k = parse_number(value, key, where);
+    } else if (key == "target") {
+        aqm.target = parse_time(value, key, where);
+    } else if (key == "interval") {
+        aqm.interval = parse_time(value, key, where);
+    } else if (key == "dctcpg") {
+        aqm.dctcp_g = parse_number(value, key, where);
+    } else if (key == "dctcpalpha") {
+        aqm.dctcp_alpha_init = parse_number(value, key, where);
+    } else {
+        return false;
+    }
+    return true;
+}
+
+// Checks the ranges of the queue options once all of them are applied, since minth and maxth can come from
+// different lines of a sweep
+void check_aqm(const AqmSpec& aqm, const std::string& where) {
+    NS_ABORT_MSG_IF(aqm.min_th < 0 || aqm.min_th > aqm.max_th,
+                    where << ": needs 0 <= minth <= maxth, got minth=" << aqm.min_th << " maxth=" << aqm.max_th);
+    NS_ABORT_MSG_IF(aqm.qw <= 0 || aqm.qw > 1, where << ": qw must be in (0, 1], got " << aqm.qw);
+    NS_ABORT_MSG_IF(aqm.k <= 0, where << ": k must be positive, got " << aqm.k);
+    NS_ABORT_MSG_IF(aqm.max_size == 0, where << ": maxsize must be positive");
+    NS_ABORT_MSG_IF(aqm.dctcp_g <= 0 || aqm.dctcp_g > 1, where << ": dctcpg must be in (0, 1], got " << aqm.dctcp_g);
+    NS_ABORT_MSG_IF(aqm.dctcp_alpha_init < 0 || aqm.dctcp_alpha_init > 1,
+                    where << ": dctcpalpha must be in [0, 1], got " << aqm.dctcp_alpha_init);
+}
+
+// Options of the queue disc, in the form of the spec
+std::string describe_aqm(const AqmSpec& aqm) {
+    std::ostringstream out;
+    out << "aqm=" << aqm.disc;
+    if (aqm.disc == "red") {
+        out << " minth=" << aqm.min_th << " maxth=" << aqm.max_th << " qw=" << aqm.qw;
+    } else if (aqm.disc == "step") {
+        out << " k=" << aqm.k;
+    } else {
+        out << " target=" << aqm.target;
+        if (aqm.disc == "fqcodel") {
+            out << " interval=" << aqm.interval;
+        }
+    }
+    out << " maxsize=" << aqm.max_size << " dctcpg=" << aqm.dctcp_g << " dctcpalpha=" << aqm.dctcp_alpha_init;
+    return out.str();
+}
+
+// Parses the sender/receiver index of a flow line, e.g. "s2" is source 1
+uint32_t parse_endpoint(const std::string& token, char prefix, uint32_t count, const std::string& where) {
+    NS_ABORT_MSG_IF(token.size() < 2 || token[0] != prefix, where << ": expected " << prefix << "<n>, got " << token);
+    uint32_t index = parse_count(token.substr(1), token, where);
+    NS_ABORT_MSG_IF(index < 1 || index > count, where << ": " << token << " is outside the topology");
+    return index - 1;
+}
+
+std::vector<ExperimentSpec> parse_spec(std::istream& in) {
+    std::vector<ExperimentSpec> specs;
+    std::string line;
+    int line_no = 0;
+
+    while (std::getline(in, line)) {
+        line_no++;
+        std::string where = "Spec line " + std::to_string(line_no);
+        line = line.substr(0, line.find('#'));
+        std::istringstream tokens(line);
+        std::string keyword;
+        if (!(tokens >> keyword)) {
+            continue;
+        }
+
+        if (keyword == "experiment") {
+            ExperimentSpec spec;
+            NS_ABORT_MSG_IF(!(tokens >> spec.name), where << ": experiment needs a name");
+            std::string option;
+            while (tokens >> option) {
+                size_t eq = option.find('=');
+                NS_ABORT_MSG_IF(eq == std::string::npos, where << ": bad option " << option);
+                std::string key = option.substr(0, eq);
+                std::string value = option.substr(eq + 1);
+                if (key == "runs") {
+                    spec.runs = parse_count(value, key, where);
+                } else if (!parse_aqm_option(spec.aqm, key, value, where)) {
+                    NS_FATAL_ERROR(where << ": unknown option " << key);
+                }
+            }
+            NS_ABORT_MSG_IF(spec.runs == 0, where << ": runs must be positive");
+            check_aqm(spec.aqm, where);
+            specs.push_back(spec);
+        } else if (keyword == "flow") {
+            NS_ABORT_MSG_IF(specs.empty(), where << ": flow before any experiment");
+            std::string sender, receiver;
+            FlowSpec flow;
+            NS_ABORT_MSG_IF(!(tokens >> sender >> receiver >> flow.tcp_variant),
+                            where << ": flow needs a sender, receiver and TCP variant");
+            flow.sender = parse_endpoint(sender, 's', num_sources, where);
+            flow.receiver = parse_endpoint(receiver, 'd', num_destinations, where);
+            std::string bytes, extra;
+            flow.bytes = tokens >> bytes ? parse_count(bytes, "bytes", where, UINT64_MAX) : maxBytes;
+            NS_ABORT_MSG_IF(flow.bytes == 0, where << ": a flow needs at least one byte");
+            NS_ABORT_MSG_IF(tokens >> extra, where << ": unexpected " << extra);
+
+            TypeId tid;
+            NS_ABORT_MSG_IF(!TypeId::LookupByNameFailSafe("ns3::" + flow.tcp_variant, &tid),
+                            where << ": unknown TCP variant " << flow.tcp_variant);
+
+            // The TCP variant is set per sender node, so one sender can only run one variant at a time
+            for (const FlowSpec& other : specs.back().flows) {
+                NS_ABORT_MSG_IF(other.sender == flow.sender && other.tcp_variant != flow.tcp_variant,
+                                where << ": " << sender << " already uses " << other.tcp_variant);
+            }
+            specs.back().flows.push_back(flow);
+        } else if (keyword == "workload") {
+            NS_ABORT_MSG_IF(specs.empty(), where << ": workload before any experiment");
+            WorkloadSpec& wl = specs.back().workload;
+            NS_ABORT_MSG_IF(!(tokens >> wl.tcp_variant), where << ": workload needs a TCP variant");
+            TypeId tid;
+            NS_ABORT_MSG_IF(!TypeId::LookupByNameFailSafe("ns3::" + wl.tcp_variant, &tid),
+                            where << ": unknown TCP variant " << wl.tcp_variant);
+
+            std::string option;
+            while (tokens >> option) {
+                size_t eq = option.find('=');
+                NS_ABORT_MSG_IF(eq == std::string::npos, where << ": bad option " << option);
+                std::string key = option.substr(0, eq);
+                std::string value = option.substr(eq + 1);
+                if (key == "load") {
+                    wl.load = parse_number(value, key, where);
+                } else if (key == "flows") {
+                    wl.flows = parse_count(value, key, where);
+                } else if (key == "cdf") {
+                    wl.cdf_name = value;
+                } else {
+                    NS_FATAL_ERROR(where << ": unknown option " << key);
+                }
+            }
+            NS_ABORT_MSG_IF(wl.load <= 0 || wl.load > 1, where << ": load must be in (0, 1]");
+            NS_ABORT_MSG_IF(wl.flows == 0, where << ": workload needs flows=<n>");
+            wl.cdf = load_cdf(wl.cdf_name);
+        } else {
+            NS_FATAL_ERROR(where << ": unknown keyword " << keyword);
+        }
+    }
+
+    for (const ExperimentSpec& spec : specs) {
+        NS_ABORT_MSG_IF(spec.flows.empty() == (spec.workload.flows == 0),
+                        "Experiment " << spec.name << " needs either flows or a workload");
+    }
+    return specs;
+}
+
+// Reads the configurations of an AQM sweep and crosses them with the experiments: every experiment runs
+// once per configuration, named <experiment>@<configuration>, with the queue options of the configuration
+// applied on top of its own
+std::vector<ExperimentSpec> expand_sweep(std::istream& in, const std::vector<ExperimentSpec>& base) {
+    std::vector<ExperimentSpec> specs;
+    std::string line;
+    int line_no = 0;
+
+    while (std::getline(in, line)) {
+        line_no++;
+        line = line.substr(0, line.find('#'));
+        std::istringstream tokens(line);
+        std::string keyword, name;
+        if (!(tokens >> keyword)) {
+            continue;
+        }
+        NS_ABORT_MSG_IF(keyword != "config" || !(tokens >> name),
+                        "Sweep line " << line_no << ": expected config <name> [options]");
 
-    dest_container.Start(Seconds(start_time));
-    dest_container.Stop(Seconds(endtime));
-    source_container.Start(Seconds(start_time));
-    source_container.Stop(Seconds(endtime));
+        std::vector<std::pair<std::string, std::string>> options;
+        std::string option;
+        while (tokens >> option) {
+            size_t eq = option.find('=');
+            NS_ABORT_MSG_IF(eq == std::string::npos, "Sweep line " << line_no << ": bad option " << option);
+            options.push_back({option.substr(0, eq), option.substr(eq + 1)});
+        }
+
+        std::string where = "Sweep config " + name + " (line " + std::to_string(line_no) + ")";
+        for (ExperimentSpec spec : base) {
+            for (const auto& [key, value] : options) {
+                NS_ABORT_MSG_IF(!parse_aqm_option(spec.aqm, key, value, where), where << ": unknown option " << key);
+            }
+            check_aqm(spec.aqm, where + " on experiment " + spec.name);
+            spec.name += "@" + name;
+            spec.sweep_config = name;
+            specs.push_back(spec);
+        }
+    }
+    NS_ABORT_MSG_IF(specs.empty(), "The sweep has no configurations");
+    return specs;
+}
+
+// Sends one line to the parent. Every worker has a pipe of its own, so lines never interleave.
+void report_line(int fd, const std::string& line) {
+    NS_ABORT_MSG_IF(write(fd, line.data(), line.size()) != (ssize_t)line.size(), "Failed to report " << line);
+}
+
+// Formats one finished flow for the parent as
+// experiment,run,flow,source,destination,source_port,destination_port,tx_bytes,rx_bytes,first_tx,last_rx,throughput,time_taken
+std::string flow_line(size_t flow) {
+    const FlowRecord& record = flows[flow];
+    double time_taken = record.last_rx.GetSeconds() - record.first_tx.GetSeconds();
+    double curr_throughput = record.rx_bytes * 8.0 / time_taken / (1024 * 1024);
+
+    std::ostringstream out;
+    out.precision(17);
+    out << cell_experiment << "," << cell_run << "," << flow << "," << record.tuple.sourceAddress << ","
+        << record.tuple.destinationAddress << "," << record.tuple.sourcePort << ","
+        << record.tuple.destinationPort << "," << record.tx_bytes << ","
+        << record.rx_bytes << "," << record.first_tx.GetSeconds() << "," << record.last_rx.GetSeconds()
+        << "," << curr_throughput << "," << time_taken << "\n";
+    return out.str();
+}
+
+void report_flow(size_t flow) {
+    flows[flow].reported = true;
+
+    // Nothing to report to, e.g. in the topology benchmark
+    if (report_fd < 0) {
+        return;
+    }
+
+    report_line(report_fd, flow_line(flow));
+}
+
+void source_tx(size_t flow, Ptr<const Packet> packet) {
+    FlowRecord& record = flows[flow];
+    if (record.tx_bytes == 0) {
+        record.first_tx = Simulator::Now();
+    }
+    record.tx_bytes += packet->GetSize();
+}
+
+void sink_rx(Ptr<const Packet> packet, const Address& from, const Address& local) {
+    InetSocketAddress remote = InetSocketAddress::ConvertFrom(from);
+    size_t flow = flow_by_source_port.at(remote.GetPort());
+    FlowRecord& record = flows[flow];
+    if (record.rx_bytes == 0) {
+        // The 5-tuple of the connection keys this flow in the results table
+        InetSocketAddress sink = InetSocketAddress::ConvertFrom(local);
+        record.tuple.sourceAddress = remote.GetIpv4();
+        record.tuple.destinationAddress = sink.GetIpv4();
+        record.tuple.protocol = 6;
+        record.tuple.sourcePort = remote.GetPort();
+        record.tuple.destinationPort = sink.GetPort();
+    }
+
+    uint64_t before = record.rx_bytes;
+    record.rx_bytes += packet->GetSize();
+    record.last_rx = Simulator::Now();
+
+    if (before < record.target_bytes && record.rx_bytes >= record.target_bytes) {
+        report_flow(flow);
+
+        // Stop as soon as the last flow completes instead of waiting out a fixed window. A rank of a
+        // distributed cell cannot stop on its own while others still need it, there every rank stops at
+        // distributed_stop_time.
+        if (++flows_done == flows_expected && !mpi) {
+            Simulator::Stop();
+        }
+    }
+}
+
+// Sets the TCP variant of every socket the node creates from now on
+void set_socket_type(Ptr<Node> node, const std::string& tcp_version) {
+    node->GetObject<TcpL4Protocol>()->SetAttribute("SocketType",
+                                                   TypeIdValue(TypeId::LookupByName("ns3::" + tcp_version)));
+}
+
+// Starts one bulk transfer from sender to receiver. The applications are created directly instead of
+// through the helpers, and every receiver runs a single sink on base_port for all flows to it.
+void data_transfer(uint32_t sender, uint32_t receiver, const Ipv4Address& receiver_address, uint16_t source_port,
+                   const std::string& tcp_version, double start_time, uint64_t bytes) {
+    Ptr<Node> src = source.Get(sender);
+    Ptr<Node> dest = destination.Get(receiver);
+
+    size_t flow = flows.size();
+    flows.push_back({bytes, 0, 0, Time(), Time(), Ipv4FlowClassifier::FiveTuple(), false});
+    flow_by_source_port[source_port] = flow;
+
+    // No stop time, the applications run until the flow completes. In a distributed cell every rank only
+    // runs the applications of its own nodes.
+    if (dest->GetSystemId() == mpi_rank && flow_sinks.insert(receiver).second) {
+        Ptr<PacketSink> sink = CreateObject<PacketSink>();
+        sink->SetAttribute("Protocol", TypeIdValue(TcpSocketFactory::GetTypeId()));
+        sink->SetAttribute("Local", AddressValue(InetSocketAddress(Ipv4Address::GetAny(), base_port)));
+        sink->SetStartTime(Seconds(start_time));
+        dest->AddApplication(sink);
+        sink->TraceConnectWithoutContext("RxWithAddresses", MakeCallback(&sink_rx));
+    }
+    if (src->GetSystemId() == mpi_rank) {
+        set_socket_type(src, tcp_version);
+
+        // MaxBytes ensures flow doesn't exceed its size from the spec
+        Ptr<BulkSendApplication> app = CreateObject<BulkSendApplication>();
+        app->SetAttribute("Protocol", TypeIdValue(TcpSocketFactory::GetTypeId()));
+        app->SetAttribute("Remote", AddressValue(InetSocketAddress(receiver_address, base_port)));
+        app->SetAttribute("Local", AddressValue(InetSocketAddress(Ipv4Address::GetAny(), source_port)));
+        app->SetAttribute("MaxBytes", UintegerValue(bytes));
+        app->SetStartTime(Seconds(start_time));
+        src->AddApplication(app);
+        app->TraceConnectWithoutContext("Tx", MakeBoundCallback(&source_tx, flow));
+    }
+}
+
+// Hands as much of the queued flows to the socket as its send buffer takes, called again by the socket
+// whenever buffer space frees up
+void workload_send(size_t conn, Ptr<Socket> socket, uint32_t available) {
+    WorkloadConnection& c = connections[conn];
+    while (c.connected && !c.unsent.empty() && available > 0) {
+        FlowRecord& record = flows[c.unsent.front()];
+        uint32_t size = std::min<uint64_t>(record.target_bytes - record.tx_bytes, available);
+        int sent = socket->Send(Create<Packet>(size));
+        if (sent <= 0) {
+            return;
+        }
+        record.tx_bytes += sent;
+        if (record.tx_bytes == record.target_bytes) {
+            c.unsent.pop_front();
+        }
+        available = socket->GetTxAvailable();
+    }
+}
+
+void workload_connected(size_t conn, Ptr<Socket> socket) {
+    connections[conn].connected = true;
+    workload_send(conn, socket, socket->GetTxAvailable());
+}
+
+void workload_connect_failed(size_t conn, Ptr<Socket>) {
+    NS_FATAL_ERROR("Workload connection " << conn << " failed to connect");
+}
+
+// Opens a new persistent connection from the sender to the sink of the receiver
+size_t open_connection(uint32_t sender, uint32_t receiver) {
+    size_t conn = connections.size();
+    Ptr<Socket> socket = Socket::CreateSocket(source.Get(sender), TcpSocketFactory::GetTypeId());
+    socket->Bind();
+    Address local;
+    socket->GetSockName(local);
+
+    Ipv4FlowClassifier::FiveTuple tuple;
+    tuple.sourceAddress = source.Get(sender)->GetObject<Ipv4>()->GetAddress(1, 0).GetLocal();
+    tuple.destinationAddress = workload_receivers[receiver];
+    tuple.protocol = 6;
+    tuple.sourcePort = InetSocketAddress::ConvertFrom(local).GetPort();
+    tuple.destinationPort = base_port;
+    connections.push_back({socket, sender, receiver, tuple, false, {}, {}});
+    connection_by_source[{tuple.sourceAddress.Get(), tuple.sourcePort}] = conn;
+
+    socket->SetConnectCallback(MakeBoundCallback(&workload_connected, conn),
+                               MakeBoundCallback(&workload_connect_failed, conn));
+    socket->SetSendCallback(MakeBoundCallback(&workload_send, conn));
+    socket->Connect(InetSocketAddress(tuple.destinationAddress, base_port));
+    return conn;
+}
+
+// Starts the next flow of the workload on an idle connection between a random sender and receiver, opening
+// a new connection when all of theirs are busy, and schedules the arrival after it
+void workload_arrival() {
+    uint32_t sender = workload_uniform->GetInteger(0, num_sources - 1);
+    uint32_t receiver = workload_uniform->GetInteger(0, num_destinations - 1);
+    uint64_t bytes = std::max(1.0, std::round(cdf_sample(workload->cdf, workload_uniform->GetValue())));
+
+    std::vector<size_t>& idle = idle_connections[{sender, receiver}];
+    size_t conn;
+    if (idle.empty()) {
+        conn = open_connection(sender, receiver);
+    } else {
+        conn = idle.back();
+        idle.pop_back();
+    }
+
+    // The flow starts when it arrives, so its completion time includes any connection setup
+    WorkloadConnection& c = connections[conn];
+    size_t flow = flows.size();
+    flows.push_back({bytes, 0, 0, Simulator::Now(), Time(), c.tuple, false});
+    c.unsent.push_back(flow);
+    c.unreceived.push_back(flow);
+    workload_send(conn, c.socket, c.socket->GetTxAvailable());
+
+    if (flows.size() < flows_expected) {
+        Simulator::Schedule(Seconds(workload_interarrival->GetValue()), &workload_arrival);
+    }
+}
+
+// Rx trace of the workload sinks. A packet may carry the end of one flow and the start of the next.
+void workload_rx(Ptr<const Packet> packet, const Address& from, const Address&) {
+    InetSocketAddress remote = InetSocketAddress::ConvertFrom(from);
+    size_t conn = connection_by_source.at({remote.GetIpv4().Get(), remote.GetPort()});
+    WorkloadConnection& c = connections[conn];
+
+    uint64_t bytes = packet->GetSize();
+    while (bytes > 0 && !c.unreceived.empty()) {
+        size_t flow = c.unreceived.front();
+        FlowRecord& record = flows[flow];
+        uint64_t received = std::min(bytes, record.target_bytes - record.rx_bytes);
+        record.rx_bytes += received;
+        record.last_rx = Simulator::Now();
+        bytes -= received;
+        if (record.rx_bytes < record.target_bytes) {
+            break;
+        }
+
+        c.unreceived.pop_front();
+        report_flow(flow);
+        if (c.unreceived.empty()) {
+            idle_connections[{c.sender, c.receiver}].push_back(conn);
+        }
+        if (++flows_done == flows_expected) {
+            Simulator::Stop();
+        }
+    }
+}
+
+// One sink per receiver takes the connections of every sender, flows arrive as a Poisson process whose
+// rate puts the given load on the bottleneck: the link between the routers of the dumbbell, the last
+// hop of every receiver in the fabrics
+void start_workload(const WorkloadSpec& wl, const std::vector<Ipv4Address>& receiver_addresses) {
+    workload = &wl;
+    workload_receivers = receiver_addresses;
+    connections.clear();
+    idle_connections.clear();
+    connection_by_source.clear();
+
+    for (uint32_t i = 0; i < num_sources; i++) {
+        set_socket_type(source.Get(i), wl.tcp_variant);
+    }
+
+    for (uint32_t i = 0; i < num_destinations; i++) {
+        Ptr<PacketSink> sink = CreateObject<PacketSink>();
+        sink->SetAttribute("Protocol", TypeIdValue(TcpSocketFactory::GetTypeId()));
+        sink->SetAttribute("Local", AddressValue(InetSocketAddress(Ipv4Address::GetAny(), base_port)));
+        destination.Get(i)->AddApplication(sink);
+        sink->TraceConnectWithoutContext("RxWithAddresses", MakeCallback(&workload_rx));
+    }
+
+    double bottleneck_bps = DataRate(link_rate).GetBitRate() * (topology == "dumbbell" ? 1.0 : num_destinations);
+    workload_interarrival = CreateObject<ExponentialRandomVariable>();
+    workload_interarrival->SetAttribute("Mean", DoubleValue(8 * cdf_mean(wl.cdf) / (wl.load * bottleneck_bps)));
+    workload_uniform = CreateObject<UniformRandomVariable>();
+
+    flows.reserve(wl.flows);
+    Simulator::Schedule(Seconds(workload_interarrival->GetValue()), &workload_arrival);
+}
+
+// Derives the number of hosts from the fabric radix, the dumbbell keeps the counts from the command line
+void size_topology() {
+    if (topology == "dumbbell") {
+        NS_ABORT_MSG_IF(num_sources == 0 || num_destinations == 0, "The dumbbell needs senders and receivers");
+        return;
+    }
+    NS_ABORT_MSG_IF(fabric_k < 2 || fabric_k % 2 != 0, "The fabric radix k must be even");
+
+    if (topology == "leafspine") {
+        // k leaves with k hosts each, sources on the first half of the leaves and destinations on the second
+        num_sources = num_destinations = fabric_k * fabric_k / 2;
+    } else if (topology == "fattree") {
+        // k pods with k/2 edge switches of k/2 hosts each, sources in the first half of the pods
+        num_sources = num_destinations = fabric_k * fabric_k * fabric_k / 8;
+    } else {
+        NS_FATAL_ERROR("Unknown topology " << topology);
+    }
+}
+
+// Switch (index into router) a sender or receiver is attached to by configure_network
+uint32_t source_switch(uint32_t i) {
+    if (topology == "dumbbell") {
+        return 0;
+    }
+    if (topology == "leafspine") {
+        return i / fabric_k;
+    }
+    uint32_t half = fabric_k / 2;
+    return i / (half * half) * fabric_k + i % (half * half) / half;
+}
+
+uint32_t destination_switch(uint32_t i) {
+    if (topology == "dumbbell") {
+        return 1;
+    }
+    if (topology == "leafspine") {
+        return fabric_k / 2 + i / fabric_k;
+    }
+    uint32_t half = fabric_k / 2;
+    return (half + i / (half * half)) * fabric_k + i % (half * half) / half;
+}
+
+// MPI rank that simulates a switch, hosts are simulated together with their switch. The dumbbell is split
+// between its two routers, leaves and spines of the leaf-spine and pods and core switches of the fat-tree
+// are dealt out round robin, so only links between switches cross ranks.
+uint32_t switch_rank(uint32_t sw) {
+    if (topology == "leafspine") {
+        return sw % fabric_k % mpi_size;
+    }
+    if (topology == "fattree") {
+        return (sw < fabric_k * fabric_k ? sw / fabric_k : sw - fabric_k * fabric_k) % mpi_size;
+    }
+    return sw % mpi_size;
 }
 
 void create_topology() {
-    source.Create(2);
-    destination.Create(2);
-    router.Create(2);
+    // Cells simulated in one process (MPI) each build their own nodes
+    source = NodeContainer();
+    destination = NodeContainer();
+    router = NodeContainer();
+
+    for (uint32_t i = 0; i < num_sources; i++) {
+        source.Add(CreateObject<Node>(switch_rank(source_switch(i))));
+    }
+    for (uint32_t i = 0; i < num_destinations; i++) {
+        destination.Add(CreateObject<Node>(switch_rank(destination_switch(i))));
+    }
+
+    // Dumbbell: the two routers. Leaf-spine: leaves first, then spines. Fat-tree: edge and aggregation
+    // switches of every pod, then the core.
+    uint32_t switches = topology == "dumbbell" ? 2 : topology == "leafspine" ? 2 * fabric_k
+                                                   : fabric_k * fabric_k + fabric_k * fabric_k / 4;
+    for (uint32_t i = 0; i < switches; i++) {
+        router.Add(CreateObject<Node>(switch_rank(i)));
+    }
+}
+
+// Connects two nodes with a point-to-point link in the next /24 subnet.
+// Devices on switches are collected in switch_ports so the AQM can be installed on every switch egress,
+// and also in bottleneck_ports when the link is one of the watched bottlenecks.
+Ipv4InterfaceContainer add_link(PointToPointHelper& pointToPoint, Ipv4AddressHelper& address,
+                                Ptr<Node> a, bool a_is_switch, Ptr<Node> b, bool b_is_switch,
+                                NetDeviceContainer& switch_ports, NetDeviceContainer* bottleneck_ports = nullptr) {
+    NetDeviceContainer devices = pointToPoint.Install(a, b);
+    Ipv4InterfaceContainer interfaces = address.Assign(devices);
+    address.NewNetwork();
+
+    for (uint32_t i = 0; i < 2; i++) {
+        if (i == 0 ? a_is_switch : b_is_switch) {
+            switch_ports.Add(devices.Get(i));
+            if (bottleneck_ports) {
+                bottleneck_ports->Add(devices.Get(i));
+            }
+        }
+    }
+    return interfaces;
 }
 
 void configure_network(PointToPointHelper& pointToPoint, Ipv4AddressHelper& address,
-                     Ipv4InterfaceContainer& i1, Ipv4InterfaceContainer& i2,
-                     Ipv4InterfaceContainer& i3, Ipv4InterfaceContainer& i4,
-                     Ipv4InterfaceContainer& i5) {
+                     const AqmSpec& aqm, std::vector<Ipv4Address>& receiver_addresses) {
     // Set buffer sizes - 256 KB
     Config::SetDefault("ns3::TcpSocket::SndBufSize", UintegerValue(262144));
     Config::SetDefault("ns3::TcpSocket::RcvBufSize", UintegerValue(262144));
     
     // Add DCTCP specific configurations
-    Config::SetDefault("ns3::TcpDctcp::DctcpShiftG", DoubleValue(0.0625));  
-    Config::SetDefault("ns3::TcpDctcp::DctcpAlphaOnInit", DoubleValue(1.0)); 
+    Config::SetDefault("ns3::TcpDctcp::DctcpShiftG", DoubleValue(aqm.dctcp_g));
+    Config::SetDefault("ns3::TcpDctcp::DctcpAlphaOnInit", DoubleValue(aqm.dctcp_alpha_init));
     Config::SetDefault("ns3::TcpDctcp::UseEct0", BooleanValue(true));
 
     InternetStackHelper internet;
+    if (routing == "nix") {
+        internet.SetRoutingHelper(Ipv4NixVectorHelper());
+    }
     internet.Install(source);
     internet.Install(destination);
     internet.Install(router);
 
-    NodeContainer link1 = NodeContainer(source.Get(0), router.Get(0));
-    NodeContainer link2 = NodeContainer(source.Get(1), router.Get(0));
-
-    // Central bottleneck link between the two routers 
-    NodeContainer link3 = NodeContainer(router.Get(0), router.Get(1));
-
-    NodeContainer link4 = NodeContainer(router.Get(1), destination.Get(1));
-    NodeContainer link5 = NodeContainer(router.Get(1), destination.Get(0));
+    pointToPoint.SetDeviceAttribute("DataRate", StringValue(link_rate));
 
-    pointToPoint.SetDeviceAttribute("DataRate", StringValue("1Gbps"));
+    // An aggregate takes as long to serialize as the packets it stands for. The initial window keeps
+    // roughly the same number of bytes.
+    Config::SetDefault("ns3::TcpSocket::SegmentSize", UintegerValue(segment_size * segment_aggregation));
+    Config::SetDefault("ns3::TcpSocket::InitialCwnd", UintegerValue(std::max(1u, 10 / segment_aggregation)));
+    pointToPoint.SetDeviceAttribute("Mtu", UintegerValue(std::max(1500u, packet_bytes * segment_aggregation)));
     
     // Low point-to-point delay to increase RTT times - low latency simulates data center
     pointToPoint.SetChannelAttribute("Delay", StringValue(".25ms"));
 
-
+    // Every link gets the next subnet starting at 10.1.1.0/24
     address.SetBase("10.1.1.0", "255.255.255.0");
-    NetDeviceContainer s1linkr1 = pointToPoint.Install(link1);
-    i1 = address.Assign(s1linkr1);
+    NetDeviceContainer switch_ports, bottleneck_ports;
+
+    if (topology == "dumbbell") {
+        for (uint32_t i = 0; i < num_sources; i++) {
+            add_link(pointToPoint, address, source.Get(i), false, router.Get(0), true, switch_ports);
+        }
+
+        // Central bottleneck link between the two routers 
+        add_link(pointToPoint, address, router.Get(0), true, router.Get(1), true, switch_ports, &bottleneck_ports);
 
-    address.SetBase("10.1.2.0", "255.255.255.0");
-    NetDeviceContainer s2linkr1 = pointToPoint.Install(link2);
-    i2 = address.Assign(s2linkr1);
+        for (uint32_t i = 0; i < num_destinations; i++) {
+            Ipv4InterfaceContainer link = add_link(pointToPoint, address, router.Get(1), true,
+                                                   destination.Get(i), false, switch_ports);
+            receiver_addresses.push_back(link.GetAddress(1));
+        }
+    } else if (topology == "leafspine") {
+        uint32_t half = fabric_k / 2;
+        for (uint32_t i = 0; i < num_sources; i++) {
+            add_link(pointToPoint, address, source.Get(i), false, router.Get(i / fabric_k), true, switch_ports);
+        }
+        for (uint32_t i = 0; i < num_destinations; i++) {
+            Ipv4InterfaceContainer link = add_link(pointToPoint, address, router.Get(half + i / fabric_k), true,
+                                                   destination.Get(i), false, switch_ports, &bottleneck_ports);
+            receiver_addresses.push_back(link.GetAddress(1));
+        }
+
+        // Every leaf connects to every spine
+        for (uint32_t leaf = 0; leaf < fabric_k; leaf++) {
+            for (uint32_t spine = 0; spine < fabric_k; spine++) {
+                add_link(pointToPoint, address, router.Get(leaf), true, router.Get(fabric_k + spine), true,
+                         switch_ports);
+            }
+        }
+    } else {
+        uint32_t half = fabric_k / 2;
 
-    address.SetBase("10.1.3.0", "255.255.255.0");
-    NetDeviceContainer r1linkr2 = pointToPoint.Install(link3);
-    i3 = address.Assign(r1linkr2);
+        // Switch indices in router: pod p has edge switches p*k + [0, k/2) and aggregation
+        // switches p*k + [k/2, k), the (k/2)^2 core switches follow all pods
+        auto edge = [&](uint32_t pod, uint32_t i) { return router.Get(pod * fabric_k + i); };
+        auto aggregation = [&](uint32_t pod, uint32_t i) { return router.Get(pod * fabric_k + half + i); };
+        auto core = [&](uint32_t i) { return router.Get(fabric_k * fabric_k + i); };
 
-    address.SetBase("10.1.4.0", "255.255.255.0");
-    NetDeviceContainer r2linkd1 = pointToPoint.Install(link5);
-    i4 = address.Assign(r2linkd1);
+        // Hosts are numbered across the edge switches, k/2 per edge switch
+        uint32_t hosts_per_pod = half * half;
+        for (uint32_t i = 0; i < num_sources; i++) {
+            add_link(pointToPoint, address, source.Get(i), false,
+                     edge(i / hosts_per_pod, (i % hosts_per_pod) / half), true, switch_ports);
+        }
+        for (uint32_t i = 0; i < num_destinations; i++) {
+            Ipv4InterfaceContainer link = add_link(pointToPoint, address,
+                                                   edge(half + i / hosts_per_pod, (i % hosts_per_pod) / half), true,
+                                                   destination.Get(i), false, switch_ports, &bottleneck_ports);
+            receiver_addresses.push_back(link.GetAddress(1));
+        }
 
-    address.SetBase("10.1.5.0", "255.255.255.0");
-    NetDeviceContainer r2linkd2 = pointToPoint.Install(link4);
-    i5 = address.Assign(r2linkd2);
+        for (uint32_t pod = 0; pod < fabric_k; pod++) {
+            for (uint32_t a = 0; a < half; a++) {
+                // Full mesh between edge and aggregation inside the pod
+                for (uint32_t e = 0; e < half; e++) {
+                    add_link(pointToPoint, address, edge(pod, e), true, aggregation(pod, a), true, switch_ports);
+                }
+                // Aggregation switch a reaches core switches a*k/2 .. a*k/2 + k/2 - 1
+                for (uint32_t c = 0; c < half; c++) {
+                    add_link(pointToPoint, address, aggregation(pod, a), true, core(a * half + c), true,
+                             switch_ports);
+                }
+            }
+        }
+    }
   
     // Reset existing queue disc before applying RED
     TrafficControlHelper tch;
-    tch.Uninstall(r1linkr2);
+    tch.Uninstall(switch_ports);
 
     Config::SetDefault("ns3::TcpSocketBase::UseEcn", StringValue("On"));
 
     TrafficControlHelper tchRed;
 
-    // Parameter choices are explained in the README
-    tchRed.SetRootQueueDisc("ns3::RedQueueDisc",
-                         "MinTh", DoubleValue(20),
-                         "MaxTh", DoubleValue(60),
-                         "QW", DoubleValue(0.0625),
-                         "LinkBandwidth", StringValue("1Gbps"),
-                         "LinkDelay", StringValue(".25ms"),
-                         "UseEcn", BooleanValue(true),
-                         "Gentle", BooleanValue(true),
-                         "FengAdaptive", BooleanValue(true),
-                         "MeanPktSize", UintegerValue(1500));
+    // With aggregation the queue discs count bytes, thresholds and limits stay in packet-level packets and
+    // RED marks an aggregate with probability scaled by its size over MeanPktSize, i.e. by the packets it
+    // stands for
+    bool byte_mode = queue_in_bytes();
+    double unit = byte_mode ? packet_bytes : 1;
+    QueueSizeValue max_size(QueueSize(byte_mode ? QueueSizeUnit::BYTES : QueueSizeUnit::PACKETS,
+                                      aqm.max_size * unit));
 
-    // Set the queue size limit 
-    Config::SetDefault("ns3::RedQueueDisc::MaxSize", 
-                      QueueSizeValue(QueueSize(QueueSizeUnit::PACKETS, 200)));
+    if (aqm.disc == "red") {
+        // Parameter choices are explained in the README
+        tchRed.SetRootQueueDisc("ns3::RedQueueDisc",
+                             "MinTh", DoubleValue(aqm.min_th * unit),
+                             "MaxTh", DoubleValue(aqm.max_th * unit),
+                             "QW", DoubleValue(aqm.qw),
+                             "LinkBandwidth", StringValue(link_rate),
+                             "LinkDelay", StringValue(".25ms"),
+                             "UseEcn", BooleanValue(true),
+                             "Gentle", BooleanValue(true),
+                             "FengAdaptive", BooleanValue(true),
+                             "MeanPktSize", UintegerValue(byte_mode ? packet_bytes : 1500),
+                             "MaxSize", max_size);
+    } else if (aqm.disc == "step") {
+        // RED on the instantaneous queue with both thresholds at K marks every packet above K and nothing below.
+        // Without gentle mode a queue at MaxTh is a forced mark rather than a random one.
+        tchRed.SetRootQueueDisc("ns3::RedQueueDisc",
+                             "MinTh", DoubleValue(aqm.k * unit),
+                             "MaxTh", DoubleValue(aqm.k * unit),
+                             "QW", DoubleValue(1.0),
+                             "LinkBandwidth", StringValue(link_rate),
+                             "LinkDelay", StringValue(".25ms"),
+                             "UseEcn", BooleanValue(true),
+                             "Gentle", BooleanValue(false),
+                             "UseHardDrop", BooleanValue(false),
+                             "MeanPktSize", UintegerValue(byte_mode ? packet_bytes : 1500),
+                             "MaxSize", max_size);
+    } else if (aqm.disc == "fqcodel") {
+        tchRed.SetRootQueueDisc("ns3::FqCoDelQueueDisc",
+                             "Target", StringValue(aqm.target),
+                             "Interval", StringValue(aqm.interval),
+                             "UseEcn", BooleanValue(true),
+                             "MaxSize", max_size);
+    } else {
+        tchRed.SetRootQueueDisc("ns3::PieQueueDisc",
+                             "QueueDelayReference", StringValue(aqm.target),
+                             "UseEcn", BooleanValue(true),
+                             "MaxSize", max_size);
+    }
 
-    // Configure RedQueueDisc only on the bottleneck link to simulate Active Queue Management
-    tchRed.Install(r1linkr2.Get(0));
-    tchRed.Install(r1linkr2.Get(1));
+    // Configure the queue disc on every switch egress to simulate Active Queue Management
+    switch_queues = tchRed.Install(switch_ports);
 
-    // Needed for static routing
-    Ipv4GlobalRoutingHelper::PopulateRoutingTables();
+    bottleneck_queues = QueueDiscContainer();
+    for (uint32_t i = 0; i < bottleneck_ports.GetN(); i++) {
+        Ptr<NetDevice> device = bottleneck_ports.Get(i);
+        bottleneck_queues.Add(device->GetNode()->GetObject<TrafficControlLayer>()->GetRootQueueDiscOnDevice(device));
+    }
 }
 
-void run_experiments(Address destinationIP1, Address destinationIP2) {
-    // Experiment 1
-    for (int i = 0; i < 3; i++, start_time += flow_time) {
-        data_transfer(source.Get(0), destination.Get(0), destinationIP1, d1_port, "TcpBic", start_time);
+// Static routes along shortest paths: a breadth-first search from every host over the point-to-point links
+// gives each switch its next hops towards that host and the number of shortest paths from each of them.
+// Between equal-cost next hops a switch picks (host / paths of a next hop) % next hops, so every tier
+// consumes its own digit of the host index and the hosts of a fabric spread evenly over all paths, e.g.
+// host h reaches the fat-tree core h % (k/2)^2. Hosts send everything to their switch.
+void populate_static_routes() {
+    struct Neighbor {
+        uint32_t node;
+        uint32_t interface;
+        Ipv4Address gateway;
+    };
+    uint32_t n = NodeList::GetNNodes();
+    std::vector<std::vector<Neighbor>> neighbors(n);
+    for (uint32_t i = 0; i < n; i++) {
+        Ptr<Node> node = NodeList::GetNode(i);
+        Ptr<Ipv4> ipv4 = node->GetObject<Ipv4>();
+        for (uint32_t d = 0; d < node->GetNDevices(); d++) {
+            Ptr<NetDevice> device = node->GetDevice(d);
+            // The loopback device has no channel
+            Ptr<Channel> channel = device->GetChannel();
+            for (size_t j = 0; channel && j < channel->GetNDevices(); j++) {
+                Ptr<NetDevice> other = channel->GetDevice(j);
+                if (other == device) {
+                    continue;
+                }
+                Ptr<Ipv4> other_ipv4 = other->GetNode()->GetObject<Ipv4>();
+                Ipv4Address gateway = other_ipv4->GetAddress(other_ipv4->GetInterfaceForDevice(other), 0).GetLocal();
+                neighbors[i].push_back({other->GetNode()->GetId(), uint32_t(ipv4->GetInterfaceForDevice(device)),
+                                        gateway});
+            }
+        }
     }
-    
-    // Experiment 2
-    for (int i = 0; i < 3; i++, start_time += flow_time) {
-        data_transfer(source.Get(0), destination.Get(0), destinationIP1, d1_port, "TcpBic", start_time);
-        data_transfer(source.Get(1), destination.Get(1), destinationIP2, d2_port, "TcpBic", start_time);
+
+    std::vector<bool> is_switch(n, false);
+    for (uint32_t i = 0; i < router.GetN(); i++) {
+        is_switch[router.Get(i)->GetId()] = true;
     }
-    
-    // Experiment 3
-    for (int i = 0; i < 3; i++, start_time += flow_time) {
-        data_transfer(source.Get(0), destination.Get(0), destinationIP1, d1_port, "TcpDctcp", start_time);
+
+    // Host routes of the switches that point to each node
+    std::vector<uint64_t> carried(n, 0);
+
+    Ipv4StaticRoutingHelper helper;
+    NodeContainer hosts(source, destination);
+    for (uint32_t h = 0; h < hosts.GetN(); h++) {
+        Ptr<Node> host = hosts.Get(h);
+        const Neighbor& uplink = neighbors[host->GetId()].at(0);
+        helper.GetStaticRouting(host->GetObject<Ipv4>())->SetDefaultRoute(uplink.gateway, uplink.interface);
+
+        // Nodes in the order of their distance from the host
+        std::vector<uint32_t> distance(n, std::numeric_limits<uint32_t>::max());
+        std::vector<uint32_t> order{host->GetId()};
+        distance[host->GetId()] = 0;
+        for (size_t i = 0; i < order.size(); i++) {
+            for (const Neighbor& next : neighbors[order[i]]) {
+                if (distance[next.node] == std::numeric_limits<uint32_t>::max()) {
+                    distance[next.node] = distance[order[i]] + 1;
+                    order.push_back(next.node);
+                }
+            }
+        }
+
+        Ipv4Address address = host->GetObject<Ipv4>()->GetAddress(1, 0).GetLocal();
+        std::vector<uint64_t> paths(n, 0);
+        paths[host->GetId()] = 1;
+        for (size_t i = 1; i < order.size(); i++) {
+            uint32_t node = order[i];
+            std::vector<const Neighbor*> closer;
+            for (const Neighbor& next : neighbors[node]) {
+                if (distance[next.node] + 1 == distance[node]) {
+                    closer.push_back(&next);
+                    paths[node] += paths[next.node];
+                }
+            }
+            if (!is_switch[node]) {
+                continue;
+            }
+            const Neighbor& hop = *closer[h / paths[closer[0]->node] % closer.size()];
+            Ptr<Ipv4StaticRouting> routes = helper.GetStaticRouting(NodeList::GetNode(node)->GetObject<Ipv4>());
+            routes->AddHostRouteTo(address, hop.gateway, hop.interface);
+            carried[hop.node]++;
+        }
     }
-    
-    // Experiment 4
-    for (int i = 0; i < 3; i++, start_time += flow_time) {
-        data_transfer(source.Get(0), destination.Get(0), destinationIP1, d1_port, "TcpDctcp", start_time);
-        data_transfer(source.Get(1), destination.Get(1), destinationIP2, d2_port, "TcpDctcp", start_time);
+
+    // Every switch of the fabric should be on the path to some host
+    for (uint32_t i = 0; i < router.GetN(); i++) {
+        NS_ABORT_MSG_IF(carried[router.Get(i)->GetId()] == 0, "Static routing sends nothing through switch " << i);
     }
-    
-    // Experiment 5
-    for (int i = 0; i < 3; i++, start_time += flow_time) {
-        data_transfer(source.Get(0), destination.Get(0), destinationIP1, d1_port, "TcpBic", start_time);
-        data_transfer(source.Get(1), destination.Get(1), destinationIP2, d2_port, "TcpDctcp", start_time);
-    }
-}
-
-void collect_and_analyze_data(std::vector<double>& tputsexp1, std::vector<double>& tputsexp2,
-                            std::vector<double>& tputs2exp2, std::vector<double>& tputsexp3,
-                            std::vector<double>& tputsexp4, std::vector<double>& tputs2exp4,
-                            std::vector<double>& tputsexp5, std::vector<double>& tputs2exp5,
-                            std::vector<double>& ftimeexp1, std::vector<double>& ftimeexp2,
-                            std::vector<double>& ftime2exp2, std::vector<double>& ftimeexp3,
-                            std::vector<double>& ftimeexp4, std::vector<double>& ftime2exp4,
-                            std::vector<double>& ftimeexp5, std::vector<double>& ftime2exp5) {
-    // Install flow monitor on all nodes
+}
+
+// Fills the routing tables of the network built for the running cell. Nix-vector routing needs no
+// tables, it computes the path to a destination the first time a packet goes there.
+void populate_routes() {
+    if (routing == "global") {
+        Ipv4GlobalRoutingHelper::PopulateRoutingTables();
+    } else if (routing == "static") {
+        populate_static_routes();
+    }
+}
+
+void trace_cwnd_changed(size_t flow, uint32_t old_cwnd, uint32_t cwnd) {
+    trace_cwnd[flow] = cwnd;
+}
+
+void trace_alpha_changed(size_t flow, uint32_t bytes_acked, uint32_t bytes_marked, double alpha) {
+    trace_alpha[flow] = alpha;
+}
+
+// RED's average queue estimate, which RedQueueDisc does not expose, updated like RED updates it on every
+// arrival, dropped or not: after an idle period it first decays by (1 - qw)^m for the m packets the link
+// could have sent meanwhile, then moves towards the length the arrival found
+void trace_red_arrival(size_t queue, double length) {
+    QueueTrace& qt = trace_queues[queue];
+    uint32_t m = 0;
+    if (qt.idle) {
+        m = uint32_t(qt.ptc * (Simulator::Now() - qt.idle_since).GetSeconds());
+        qt.idle = false;
+    }
+    qt.avg = qt.avg * std::pow(1 - trace_qw, m + 1) + trace_qw * length;
+}
+
+void trace_red_enqueue(size_t queue, Ptr<const QueueDiscItem> item) {
+    const Ptr<QueueDisc>& qd = trace_queues[queue].queue;
+    trace_red_arrival(queue, queue_in_bytes() ? qd->GetNBytes() - item->GetSize() : qd->GetNPackets() - 1);
+}
+
+void trace_red_drop(size_t queue, Ptr<const QueueDiscItem>, const char*) {
+    const Ptr<QueueDisc>& qd = trace_queues[queue].queue;
+    trace_red_arrival(queue, queue_in_bytes() ? qd->GetNBytes() : qd->GetNPackets());
+}
+
+// RED counts a queue idle from the dequeue that finds it empty, taken here as the moment it empties
+void trace_queue_length(size_t queue, uint32_t old_length, uint32_t length) {
+    if (length == 0 && old_length > 0) {
+        trace_queues[queue].idle = true;
+        trace_queues[queue].idle_since = Simulator::Now();
+    }
+}
+
+// Writes the buffered rows as one block: the row count, then every column's rows back to back
+void flush_trace_table() {
+    uint32_t rows = trace_table.rows;
+    trace_table.file.write(reinterpret_cast<const char*>(&rows), sizeof(rows));
+    for (size_t column = 0; column < trace_table.columns.size(); column++) {
+        trace_table.file.write(reinterpret_cast<const char*>(&trace_table.data[column * trace_buffer_rows]),
+                               rows * sizeof(double));
+    }
+    trace_table.rows = 0;
+}
+
+void sample_traces() {
+    size_t row = trace_table.rows++;
+    size_t column = 0;
+    auto put = [&](double value) { trace_table.data[column++ * trace_buffer_rows + row] = value; };
+
+    put(Simulator::Now().GetSeconds());
+    for (double cwnd : trace_cwnd) {
+        put(cwnd);
+    }
+    for (double alpha : trace_alpha) {
+        put(alpha);
+    }
+    for (QueueTrace& qt : trace_queues) {
+        // Marks and drops are reported per interval, so they read directly as the ECN mark and drop rate
+        const QueueDisc::Stats& stats = qt.queue->GetStats();
+        put(queue_in_bytes() ? qt.queue->GetNBytes() : qt.queue->GetNPackets());
+        put(qt.avg);
+        put(stats.nTotalMarkedPackets - qt.marks);
+        put(stats.nTotalDroppedPackets - qt.drops);
+        qt.marks = stats.nTotalMarkedPackets;
+        qt.drops = stats.nTotalDroppedPackets;
+    }
+
+    if (trace_table.rows == trace_buffer_rows) {
+        flush_trace_table();
+    }
+
+    // Stop sampling with the last flow so the event queue can drain
+    if (flows_done < flows_expected) {
+        Simulator::Schedule(trace_interval, &sample_traces);
+    }
+}
+
+// Socket traces can only be connected once the applications have created their sockets
+void connect_socket_traces(const ExperimentSpec& spec) {
+    std::map<uint32_t, uint32_t> sockets_per_sender;
+    for (size_t flow = 0; flow < spec.flows.size(); flow++) {
+        const FlowSpec& fs = spec.flows[flow];
+        std::string socket = "/NodeList/" + std::to_string(source.Get(fs.sender)->GetId()) +
+                             "/$ns3::TcpL4Protocol/SocketList/" + std::to_string(sockets_per_sender[fs.sender]++);
+
+        Config::ConnectWithoutContext(socket + "/CongestionWindow", MakeBoundCallback(&trace_cwnd_changed, flow));
+        // Other variants have no alpha, their column stays NaN
+        if (fs.tcp_variant == "TcpDctcp") {
+            Config::ConnectWithoutContextFailSafe(socket + "/CongestionOps/$ns3::TcpDctcp/CongestionEstimate",
+                                                  MakeBoundCallback(&trace_alpha_changed, flow));
+        }
+    }
+}
+
+// Samples cwnd and DCTCP alpha of every flow and length, average, marks and drops of every bottleneck
+// queue every trace_interval. The file starts with the column names followed by blocks of samples.
+// Lengths and averages are in the unit of the queue discs. The average follows RED (QW=1 for step
+// marking), FqCoDel and PIE keep none and their column stays NaN.
+void start_tracing(const ExperimentSpec& spec, const std::string& file_name) {
+    trace_table.columns = {"time"};
+    for (size_t flow = 0; flow < spec.flows.size(); flow++) {
+        trace_table.columns.push_back("cwnd_" + std::to_string(flow + 1));
+    }
+    for (size_t flow = 0; flow < spec.flows.size(); flow++) {
+        trace_table.columns.push_back("alpha_" + std::to_string(flow + 1));
+    }
+    for (uint32_t queue = 0; queue < bottleneck_queues.GetN(); queue++) {
+        for (std::string series : {"len", "avg", "marks", "drops"}) {
+            trace_table.columns.push_back("q" + std::to_string(queue + 1) + "_" + series);
+        }
+    }
+    trace_table.data.assign(trace_table.columns.size() * trace_buffer_rows, 0.0);
+    trace_table.rows = 0;
+
+    // Header: column count, then every name as its length followed by its characters
+    trace_table.file.open(file_name, std::ios::binary);
+    uint32_t count = trace_table.columns.size();
+    trace_table.file.write(reinterpret_cast<const char*>(&count), sizeof(count));
+    for (const std::string& name : trace_table.columns) {
+        uint16_t length = name.size();
+        trace_table.file.write(reinterpret_cast<const char*>(&length), sizeof(length));
+        trace_table.file.write(name.data(), length);
+    }
+
+    trace_cwnd.assign(spec.flows.size(), 0.0);
+    trace_alpha.assign(spec.flows.size(), std::numeric_limits<double>::quiet_NaN());
+    // A worker may trace several cells, the queues of the earlier ones are gone with their simulation
+    trace_queues.clear();
+    bool average = spec.aqm.disc == "red" || spec.aqm.disc == "step";
+    trace_qw = spec.aqm.disc == "step" ? 1.0 : spec.aqm.qw;
+    for (uint32_t queue = 0; queue < bottleneck_queues.GetN(); queue++) {
+        Ptr<QueueDisc> qd = bottleneck_queues.Get(queue);
+        double avg = average ? 0.0 : std::numeric_limits<double>::quiet_NaN();
+        // RED starts out idle since time 0
+        trace_queues.push_back({qd, avg, 0, 0, 0, true, Time()});
+        if (average) {
+            DataRateValue rate;
+            UintegerValue mean_packet;
+            qd->GetAttribute("LinkBandwidth", rate);
+            qd->GetAttribute("MeanPktSize", mean_packet);
+            trace_queues.back().ptc = rate.Get().GetBitRate() / (8.0 * mean_packet.Get());
+            qd->TraceConnectWithoutContext("Enqueue", MakeBoundCallback(&trace_red_enqueue, (size_t)queue));
+            qd->TraceConnectWithoutContext("DropBeforeEnqueue", MakeBoundCallback(&trace_red_drop, (size_t)queue));
+            qd->TraceConnectWithoutContext(queue_length_trace(), MakeBoundCallback(&trace_queue_length, (size_t)queue));
+        }
+    }
+
+    Simulator::Schedule(NanoSeconds(1), &connect_socket_traces, spec);
+    Simulator::Schedule(trace_interval, &sample_traces);
+}
+
+void finish_tracing() {
+    if (trace_table.rows > 0) {
+        flush_trace_table();
+    }
+    trace_table.file.close();
+
+    // Release the queue discs before the simulation that owns them is destroyed
+    trace_queues.clear();
+}
+
+// Dequeue trace of a bottleneck queue, the queue disc stamped the item when it was enqueued
+void trace_dequeue(size_t queue, Ptr<const QueueDiscItem> item) {
+    size_t traffic_class = delay_classes.size() - 1;
+    Ptr<const Ipv4QueueDiscItem> ip = DynamicCast<const Ipv4QueueDiscItem>(item);
+    if (ip) {
+        auto it = delay_class_of.find(ip->GetHeader().GetSource().Get());
+        if (it != delay_class_of.end()) {
+            traffic_class = it->second;
+        }
+    }
+
+    DelayHistogram& histogram = delay_histograms[queue * delay_classes.size() + traffic_class];
+    uint64_t ns = (Simulator::Now() - item->GetTimeStamp()).GetNanoSeconds();
+    histogram.counts[hist_index(ns)]++;
+    histogram.total++;
+    histogram.max_ns = std::max(histogram.max_ns, ns);
+}
+
+// Classes packets by the TCP variant of their sender and allocates every histogram up front, so
+// recording a packet is a lookup and an increment
+void start_queue_delay(const ExperimentSpec& spec) {
+    std::vector<std::string> sender_variant(num_sources);
+    for (const FlowSpec& fs : spec.flows) {
+        sender_variant[fs.sender] = fs.tcp_variant;
+    }
+    if (spec.workload.flows > 0) {
+        sender_variant.assign(num_sources, spec.workload.tcp_variant);
+    }
+
+    delay_classes.clear();
+    delay_class_of.clear();
+    for (uint32_t i = 0; i < num_sources; i++) {
+        if (sender_variant[i].empty()) {
+            continue;
+        }
+        auto it = std::find(delay_classes.begin(), delay_classes.end(), sender_variant[i]);
+        if (it == delay_classes.end()) {
+            it = delay_classes.insert(delay_classes.end(), sender_variant[i]);
+        }
+        Ipv4Address address = source.Get(i)->GetObject<Ipv4>()->GetAddress(1, 0).GetLocal();
+        delay_class_of[address.Get()] = it - delay_classes.begin();
+    }
+    delay_classes.push_back("ack");
+
+    DelayHistogram empty;
+    empty.counts.assign(hist_buckets, 0);
+    delay_histograms.assign(bottleneck_queues.GetN() * delay_classes.size(), empty);
+    for (uint32_t queue = 0; queue < bottleneck_queues.GetN(); queue++) {
+        bottleneck_queues.Get(queue)->TraceConnectWithoutContext("Dequeue",
+                                                                 MakeBoundCallback(&trace_dequeue, (size_t)queue));
+    }
+}
+
+// Formats histogram i as
+// qdelay,experiment,run,queue,class,packets,max_ns,<bucket>:<count> <bucket>:<count> ...
+std::string queue_delay_line(size_t i) {
+    const DelayHistogram& histogram = delay_histograms[i];
+    std::ostringstream out;
+    out << "qdelay," << cell_experiment << "," << cell_run << "," << i / delay_classes.size() << ","
+        << delay_classes[i % delay_classes.size()] << "," << histogram.total << "," << histogram.max_ns << ",";
+    const char* separator = "";
+    for (size_t index = 0; index < hist_buckets; index++) {
+        if (histogram.counts[index] > 0) {
+            out << separator << index << ":" << histogram.counts[index];
+            separator = " ";
+        }
+    }
+    out << "\n";
+    return out.str();
+}
+
+// Reports every histogram that saw packets
+void report_queue_delay() {
+    for (size_t i = 0; i < delay_histograms.size(); i++) {
+        if (delay_histograms[i].total > 0 && report_fd >= 0) {
+            report_line(report_fd, queue_delay_line(i));
+        }
+    }
+}
+
+void track_peak_queue(uint32_t old_length, uint32_t length) {
+    peak_queue = std::max(peak_queue, length);
+}
+
+// Interval throughput of one flow of the running cell, kept as running statistics only. interval_rate
+// holds the sample of the current interval, so sampling allocates nothing.
+struct FlowFairness {
+    uint64_t last_rx = 0;
+    double interval_rate = 0;
+    RunningStats rate;
+    Time last_unfair;
+    bool unfair = false;
+};
+
+// Jain's index over the intervals with two or more flows running, and the start of the first interval in
+// which all flows of the cell ran and received data
+std::vector<FlowFairness> flow_fairness;
+RunningStats jain_index;
+Time contention_start;
+bool contended = false;
+
+// Whether the experiment gets fairness metrics: only fixed flows compete for the whole run, and the ranks
+// of a distributed cell only see their own sinks
+bool fairness_applies(const ExperimentSpec& spec) {
+    return fairness_interval.IsStrictlyPositive() && spec.flows.size() >= 2 && spec.workload.flows == 0 &&
+           !mpi;
+}
+
+// Takes one interval throughput sample of every flow from the sink counters. A flow counts while it runs,
+// the interval it completes in is only partly used and left out.
+void sample_fairness() {
+    Time now = Simulator::Now();
+    double sum = 0, sum_squares = 0;
+    size_t running = 0;
+    for (size_t flow = 0; flow < flows.size(); flow++) {
+        FlowFairness& ff = flow_fairness[flow];
+        ff.interval_rate = (flows[flow].rx_bytes - ff.last_rx) * 8.0 / fairness_interval.GetSeconds() / (1024 * 1024);
+        ff.last_rx = flows[flow].rx_bytes;
+        if (!flows[flow].reported) {
+            running_add(ff.rate, ff.interval_rate);
+            sum += ff.interval_rate;
+            sum_squares += ff.interval_rate * ff.interval_rate;
+            running++;
+        }
+    }
+
+    // Intervals in which nothing arrived, e.g. during the handshakes, say nothing about fairness
+    if (running >= 2 && sum > 0) {
+        running_add(jain_index, sum * sum / (running * sum_squares));
+    }
+
+    // Fair share is the mean throughput of the flows, measured while all of them compete
+    if (running == flows.size() && sum > 0) {
+        if (!contended) {
+            contention_start = now - fairness_interval;
+            contended = true;
+        }
+        double fair_share = sum / running;
+        for (size_t flow = 0; flow < flows.size(); flow++) {
+            if (std::abs(flow_fairness[flow].interval_rate - fair_share) > convergence_band * fair_share) {
+                flow_fairness[flow].last_unfair = now;
+                flow_fairness[flow].unfair = true;
+            }
+        }
+    }
+
+    if (flows_done < flows_expected) {
+        Simulator::Schedule(fairness_interval, &sample_fairness);
+    }
+}
+
+void start_fairness() {
+    flow_fairness.assign(flows.size(), FlowFairness());
+    jain_index = RunningStats();
+    contended = false;
+    Simulator::Schedule(fairness_interval, &sample_fairness);
+}
+
+// Reports fairness,experiment,run,flow,jain_index,convergence_time,throughput_sd for every flow. The
+// index is the mean over the intervals of the cell, the same for all its flows. A flow converged at the
+// end of the last interval it was outside the band, counted from the start of the contention; a flow
+// that never settled gets the whole contention period.
+void report_fairness() {
+    for (size_t flow = 0; flow < flows.size() && report_fd >= 0; flow++) {
+        const FlowFairness& ff = flow_fairness[flow];
+        double convergence = ff.unfair ? (ff.last_unfair - contention_start).GetSeconds() : 0;
+        std::ostringstream out;
+        out.precision(17);
+        out << "fairness," << cell_experiment << "," << cell_run << "," << flow << ","
+            << (jain_index.n > 0 ? jain_index.mean : 1) << "," << convergence << "," << running_sd(ff.rate)
+            << "\n";
+        report_line(report_fd, out.str());
+    }
+}
+
+void run_experiment(const ExperimentSpec& spec, const std::vector<Ipv4Address>& receiver_addresses) {
+    if (spec.workload.flows > 0) {
+        flows_expected = spec.workload.flows;
+        start_workload(spec.workload, receiver_addresses);
+        return;
+    }
+
+    // Every cell starts its flows at time 0 on its own topology
+    flows_expected = spec.flows.size();
+    double start_time = 0.0;
+    flow_by_source_port.clear();
+    flow_sinks.clear();
+
+    NS_ABORT_MSG_IF(base_port + spec.flows.size() > 65535,
+                    "Experiment " << spec.name << " has more flows than free ports after " << base_port);
+    for (size_t flow = 0; flow < spec.flows.size(); flow++) {
+        const FlowSpec& fs = spec.flows[flow];
+        data_transfer(fs.sender, fs.receiver, receiver_addresses[fs.receiver], base_port + 1 + flow,
+                      fs.tcp_variant, start_time, fs.bytes);
+    }
+}
+
+double seconds_since(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Peak resident set size of this process in KB
+long peak_rss_kb() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+// Wall-clock cost of the phases of one cell, measured inside its worker
+struct CellTiming {
+    double setup;
+    double routing;
+    double run;
+    double post;
+    uint64_t events;
+};
+
+// Formats a timing as setup_s,routing_s,run_s,post_s,events,events_per_s,peak_rss_kb
+std::string format_timing(const CellTiming& timing) {
+    std::ostringstream out;
+    out << timing.setup << "," << timing.routing << "," << timing.run << "," << timing.post << ","
+        << timing.events << "," << timing.events / timing.run << "," << peak_rss_kb();
+    return out.str();
+}
+
+// Merges the flow counters and queue delay histograms of every rank of a distributed cell on rank 0.
+// Each flow is sent by one rank and received by another, rank 0 takes the sending side from the rank
+// that sent bytes and the receiving side, with the 5-tuple, from the rank that received them.
+void gather_distributed_cell() {
+#ifdef NS3_MPI
+    MPI_Comm comm = MpiInterface::GetCommunicator();
+
+    struct FlowHalf {
+        uint64_t tx_bytes;
+        uint64_t rx_bytes;
+        int64_t first_tx_ns;
+        int64_t last_rx_ns;
+        uint32_t source_address;
+        uint32_t destination_address;
+        uint16_t source_port;
+        uint16_t destination_port;
+    };
+    std::vector<FlowHalf> local;
+    for (const FlowRecord& record : flows) {
+        local.push_back({record.tx_bytes, record.rx_bytes, record.first_tx.GetNanoSeconds(),
+                         record.last_rx.GetNanoSeconds(), record.tuple.sourceAddress.Get(),
+                         record.tuple.destinationAddress.Get(), record.tuple.sourcePort,
+                         record.tuple.destinationPort});
+    }
+    std::vector<FlowHalf> all(mpi_rank == 0 ? local.size() * mpi_size : 0);
+    MPI_Gather(local.data(), local.size() * sizeof(FlowHalf), MPI_BYTE,
+               all.data(), local.size() * sizeof(FlowHalf), MPI_BYTE, 0, comm);
+
+    for (size_t i = 0; i < all.size(); i++) {
+        const FlowHalf& half = all[i];
+        FlowRecord& record = flows[i % flows.size()];
+        if (half.tx_bytes > 0) {
+            record.tx_bytes = half.tx_bytes;
+            record.first_tx = NanoSeconds(half.first_tx_ns);
+        }
+        if (half.rx_bytes > 0) {
+            record.rx_bytes = half.rx_bytes;
+            record.last_rx = NanoSeconds(half.last_rx_ns);
+            record.tuple.sourceAddress = Ipv4Address(half.source_address);
+            record.tuple.destinationAddress = Ipv4Address(half.destination_address);
+            record.tuple.protocol = 6;
+            record.tuple.sourcePort = half.source_port;
+            record.tuple.destinationPort = half.destination_port;
+        }
+    }
+
+    // Every rank has the same histograms, each only filled for its own queues
+    for (DelayHistogram& histogram : delay_histograms) {
+        void* counts = mpi_rank == 0 ? MPI_IN_PLACE : histogram.counts.data();
+        MPI_Reduce(counts, histogram.counts.data(), hist_buckets, MPI_UINT64_T, MPI_SUM, 0, comm);
+        MPI_Reduce(mpi_rank == 0 ? MPI_IN_PLACE : &histogram.total, &histogram.total, 1, MPI_UINT64_T,
+                   MPI_SUM, 0, comm);
+        MPI_Reduce(mpi_rank == 0 ? MPI_IN_PLACE : &histogram.max_ns, &histogram.max_ns, 1, MPI_UINT64_T,
+                   MPI_MAX, 0, comm);
+    }
+#endif
+}
+
+// Simulated time every rank of a distributed cell stops at, the same on all of them: --mpiStopTime, or
+// twice the time all bytes of the cell take over a single link one after the other, plus a second.
+// Flows that have not completed by then are reported with what they received.
+Time distributed_stop_time(const ExperimentSpec& spec) {
+    if (mpi_stop_time.IsStrictlyPositive()) {
+        return mpi_stop_time;
+    }
+    uint64_t bytes = 0;
+    for (const FlowSpec& flow : spec.flows) {
+        bytes += flow.bytes;
+    }
+    return Seconds(2.0 * 8 * bytes / DataRate(link_rate).GetBitRate() + 1);
+}
+
+// Simulates a single (experiment, run) cell and streams one line per finished flow to out_fd.
+// Runs inside a forked worker, so the topology and simulator state belong to this cell only, or on every
+// rank of a distributed simulation, which build the same topology and each simulate their part of it.
+// Setup covers create_topology, configure_network and installing the applications, routing covers
+// populate_routes and post covers everything after Simulator::Run; the split is stored in timing if given.
+void run_cell(size_t experiment, uint32_t run, int out_fd, CellTiming* timing = nullptr) {
+    const ExperimentSpec& spec = experiments[experiment];
+    RngSeedManager::SetSeed(seed);
+    RngSeedManager::SetRun(run + 1);
+    cell_experiment = experiment;
+    cell_run = run;
+    report_fd = out_fd;
+    flows.clear();
+    flows_done = 0;
+
+    PointToPointHelper pointToPoint;
+    Ipv4AddressHelper address;
+    std::vector<Ipv4Address> receiver_addresses;
+
+    auto start = std::chrono::steady_clock::now();
+    create_topology();
+    configure_network(pointToPoint, address, spec.aqm, receiver_addresses);
+
+    // The adaptive replication needs to know whether RED ever drew a random number. Every stored cell
+    // records it, since a later --adaptive run reads cells back that were simulated without it.
+    peak_queue = 0;
+    for (uint32_t i = 0; i < switch_queues.GetN(); i++) {
+        switch_queues.Get(i)->TraceConnectWithoutContext(queue_length_trace(), MakeCallback(&track_peak_queue));
+    }
+    double setup_time = seconds_since(start);
+
+    start = std::chrono::steady_clock::now();
+    populate_routes();
+    double routing_time = seconds_since(start);
+
+    start = std::chrono::steady_clock::now();
+    run_experiment(spec, receiver_addresses);
+    if (queue_delay) {
+        start_queue_delay(spec);
+    }
+    if (fairness_applies(spec)) {
+        start_fairness();
+    }
+
+    bool tracing = trace_interval.IsStrictlyPositive();
+    if (tracing) {
+        start_tracing(spec, "tcp_hchench_adlapp_trace-exp" + spec.name + "-run" + std::to_string(run + 1) + ".bin");
+    }
+
+    // Full per-flow statistics are only kept when the XML dump is requested
     FlowMonitorHelper flowmon;
-    Ptr<FlowMonitor> monitor = flowmon.InstallAll();
-   
-    // Run the simulation and clean up
-    Simulator::Stop(Seconds(2000));
+    Ptr<FlowMonitor> monitor;
+    if (flowmon_xml) {
+        monitor = flowmon.InstallAll();
+    }
+    setup_time += seconds_since(start);
+
+    if (mpi) {
+        Simulator::Stop(distributed_stop_time(spec));
+    }
+
+    // Run the simulation until every flow has received maxBytes, then clean up
+    start = std::chrono::steady_clock::now();
     Simulator::Run();
+    double run_time = seconds_since(start);
+    uint64_t events = Simulator::GetEventCount();
+
+    start = std::chrono::steady_clock::now();
+    if (tracing) {
+        finish_tracing();
+    }
+
+    // The distributed simulator tears down the MPI state of ns-3 in Destroy, so the ranks exchange their
+    // results before it
+    if (mpi) {
+        gather_distributed_cell();
+    }
     Simulator::Destroy();
-  
-    monitor->CheckForLostPackets();
-    Ptr<Ipv4FlowClassifier> classifier = DynamicCast<Ipv4FlowClassifier>(flowmon.GetClassifier());
-    std::map<FlowId, FlowMonitor::FlowStats> stats = monitor->GetFlowStats();
-
-    int flowid = 1;
-
-    for (int i = 0; i < 15; i++) {
-        FlowMonitor::FlowStats fs = stats[flowid];
-        double time_taken = fs.timeLastRxPacket.GetSeconds() - fs.timeFirstTxPacket.GetSeconds();
-        double curr_throughput = fs.rxBytes * 8.0 / time_taken / (1024 * 1024);    
-        if (flowid < 7) {
-            // Experiment 1
-            tputsexp1.push_back(curr_throughput);
-            ftimeexp1.push_back(time_taken);
-            std::cout << "exp1 -thpt - " << curr_throughput << std::endl;
-            std::cout << "exp1 -time - " << time_taken << std::endl;
-        } else if (flowid < 18) {
-            // Experiment 2
-            tputsexp2.push_back(curr_throughput);
-            ftimeexp2.push_back(time_taken);
-            std::cout << "exp2 -thpt link 1 - " << curr_throughput << std::endl;
-            std::cout << "exp2-time link 1 - " << time_taken << std::endl;
-           
-            FlowMonitor::FlowStats fs = stats[flowid + 1];
-            flowid += 2;
-            time_taken = fs.timeLastRxPacket.GetSeconds() - fs.timeFirstTxPacket.GetSeconds();
-            curr_throughput = fs.rxBytes * 8.0 / time_taken / (1024 * 1024);
-            tputs2exp2.push_back(curr_throughput);
-            ftime2exp2.push_back(time_taken);
-            std::cout << "exp2 -thpt link 2 - " << curr_throughput << std::endl;
-            std::cout << "exp2-time link 2 - " << time_taken << std::endl;
-        } else if (flowid < 25) {
-            // Experiment 3
-            tputsexp3.push_back(curr_throughput);
-            ftimeexp3.push_back(time_taken);
-            std::cout << "exp3 -thpt - " << curr_throughput << std::endl;
-            std::cout << "exp3 -time - " << time_taken << std::endl;
-        } else if (flowid < 37) {
-            // Experiment 4
-            tputsexp4.push_back(curr_throughput);
-            ftimeexp4.push_back(time_taken);
-            std::cout << "exp4 -thpt link 1 - " << curr_throughput << std::endl;
-            std::cout << "exp4-time link 1 - " << time_taken << std::endl;
-            
-            FlowMonitor::FlowStats fs = stats[flowid + 1];
-            flowid += 2;
-            time_taken = fs.timeLastRxPacket.GetSeconds() - fs.timeFirstTxPacket.GetSeconds();
-            curr_throughput = fs.rxBytes * 8.0 / time_taken / (1024 * 1024);
-            tputs2exp4.push_back(curr_throughput);
-            ftime2exp4.push_back(time_taken);
-            std::cout << "exp4 -thpt link 2 - " << curr_throughput << std::endl;
-            std::cout << "exp4-time link 2 - " << time_taken << std::endl;
+
+    // Flows that never completed are still reported with whatever they received. The ranks of a
+    // distributed cell only know their half of each flow, rank 0 reports them once they are gathered.
+    for (size_t flow = 0; flow < flows.size() && !mpi; flow++) {
+        if (!flows[flow].reported) {
+            std::cerr << "Experiment " << spec.name << " run " << run + 1 << ": flow " << flow + 1
+                      << " received only " << flows[flow].rx_bytes << " bytes" << std::endl;
+            report_flow(flow);
+        }
+    }
+    if (queue_delay && !mpi) {
+        report_queue_delay();
+    }
+    if (fairness_applies(spec)) {
+        report_fairness();
+    }
+
+    if (flowmon_xml) {
+        monitor->CheckForLostPackets();
+        monitor->SerializeToXmlFile("ns3simulator-exp" + spec.name + "-run" +
+                                    std::to_string(run + 1) + ".flowmon", true, true);
+    }
+
+    if (timing) {
+        *timing = {setup_time, routing_time, run_time, seconds_since(start), events};
+    }
+}
+
+struct Worker {
+    pid_t pid;
+    int fd;
+    std::string label;
+    std::string buffer;
+};
+
+// Runs one forked worker per task, at most pool_size at a time. next(task, label) hands out the next task
+// and its name for errors, or returns false when there is nothing to start right now; it is asked again
+// after every batch of lines, so on_line may queue more tasks. body(task, fd) runs inside the worker and
+// reports lines on fd, each line is handed to on_line as soon as it arrives.
+void run_workers(const std::function<bool(size_t&, std::string&)>& next, uint32_t pool_size,
+                 const std::function<void(size_t, int)>& body,
+                 const std::function<void(const std::string&)>& on_line) {
+    std::vector<Worker> active;
+    pool_size = std::max(pool_size, 1u);
+
+    size_t task;
+    std::string label;
+    bool more = next(task, label);
+    while (more || !active.empty()) {
+        // Keep the pool full
+        for (; more && active.size() < pool_size; more = next(task, label)) {
+            int fds[2];
+            NS_ABORT_MSG_IF(pipe(fds) != 0, "Failed to create worker pipe");
+
+            // Flush before forking so buffered output is not written twice
+            std::cout.flush();
+            pid_t pid = fork();
+            NS_ABORT_MSG_IF(pid < 0, "Failed to fork worker");
+            if (pid == 0) {
+                close(fds[0]);
+                body(task, fds[1]);
+                close(fds[1]);
+                std::cout.flush();
+                _exit(0);
+            }
+            close(fds[1]);
+            active.push_back({pid, fds[0], label, ""});
+        }
+
+        // Collect output from whichever workers have something to say
+        std::vector<pollfd> pfds;
+        for (const Worker& w : active) {
+            pfds.push_back({w.fd, POLLIN, 0});
+        }
+        NS_ABORT_MSG_IF(poll(pfds.data(), pfds.size(), -1) < 0, "Failed to poll workers");
+
+        for (size_t i = pfds.size(); i-- > 0;) {
+            if (pfds[i].revents == 0) {
+                continue;
+            }
+            Worker& w = active[i];
+            char buf[4096];
+            ssize_t n = read(w.fd, buf, sizeof(buf));
+            if (n > 0) {
+                w.buffer.append(buf, n);
+
+                // Pass on complete lines and keep any partial one for the next read
+                size_t start = 0, end;
+                while ((end = w.buffer.find('\n', start)) != std::string::npos) {
+                    on_line(w.buffer.substr(start, end - start));
+                    start = end + 1;
+                }
+                w.buffer.erase(0, start);
+                continue;
+            }
+
+            // End of output, the worker is done
+            close(w.fd);
+            int status;
+            waitpid(w.pid, &status, 0);
+            NS_ABORT_MSG_IF(!WIFEXITED(status) || WEXITSTATUS(status) != 0, w.label << " failed");
+            active.erase(active.begin() + i);
+        }
+
+        // Lines handled above may have queued more tasks
+        if (!more) {
+            more = next(task, label);
+        }
+    }
+}
+
+// Runs a fixed list of tasks, one per label
+void run_workers(const std::vector<std::string>& labels, uint32_t pool_size,
+                 const std::function<void(size_t, int)>& body,
+                 const std::function<void(const std::string&)>& on_line) {
+    size_t next = 0;
+    run_workers([&](size_t& task, std::string& label) {
+        if (next == labels.size()) {
+            return false;
+        }
+        task = next;
+        label = labels[next++];
+        return true;
+    }, pool_size, body, on_line);
+}
+
+// Version of ns-3 the results were simulated with. Without --enable-build-version and --ns3Version the
+// cells are stored under the version "unknown", which no release ever matches.
+std::string ns3_version() {
+    static std::string version;
+    if (!version.empty()) {
+        return version;
+    }
+    version = ns3_release;
+#ifdef HAVE_NS3_VERSION
+    if (version.empty()) {
+        version = Version::LongVersion();
+    }
+#endif
+    if (version.empty()) {
+        std::cerr << "Warning: ns-3 was built without --enable-build-version, results are stored under ns-3 "
+                     "version unknown, give the release with --ns3Version" << std::endl;
+        version = "unknown";
+    }
+    return version;
+}
+
+// Everything that decides the outcome of one cell, in the form of the spec where there is one: experiment,
+// model revision and ns-3 version, network, seed and run, queue options, the stop time of a distributed cell,
+// and the flows or workload of the experiment. The cell is stored under the hash of this description.
+std::string describe_cell(size_t experiment, uint32_t run) {
+    const ExperimentSpec& spec = experiments[experiment];
+    std::ostringstream out;
+    out.precision(17);
+    out << "experiment=" << spec.name << " model=" << model_revision << " ns3=" << ns3_version()
+        << " topology=" << topology << " k=" << fabric_k << " senders=" << num_sources
+        << " receivers=" << num_destinations << " rate=" << link_rate << " aggregation=" << segment_aggregation
+        << " port=" << base_port << " seed=" << seed << " run=" << run + 1 << " qdelay=" << queue_delay << " "
+        << describe_aqm(spec.aqm);
+
+    // A single path leaves nothing to choose for the routing
+    if (topology != "dumbbell") {
+        out << " routing=" << routing;
+    }
+    for (const FlowSpec& flow : spec.flows) {
+        out << " | flow s" << flow.sender + 1 << " d" << flow.receiver + 1 << " " << flow.tcp_variant << " "
+            << flow.bytes;
+    }
+    if (fairness_applies(spec)) {
+        out << " fairness=" << fairness_interval.GetNanoSeconds() << "ns band=" << convergence_band;
+    }
+    // A distributed cell stops at a fixed time that may cut its flows short, so it is never read back as
+    // a complete sequential run
+    if (mpi) {
+        out << " stop=" << distributed_stop_time(spec).GetNanoSeconds() << "ns";
+    }
+    if (spec.workload.flows > 0) {
+        out << " | workload " << spec.workload.tcp_variant << " load=" << spec.workload.load
+            << " flows=" << spec.workload.flows << " cdf=" << spec.workload.cdf_name;
+        for (const auto& [bytes, probability] : spec.workload.cdf) {
+            out << " " << bytes << ":" << probability;
+        }
+    }
+    return out.str();
+}
+
+int64_t cell_hash(size_t experiment, uint32_t run) {
+    return Hash64(describe_cell(experiment, run));
+}
+
+void db_exec(const std::string& sql) {
+    char* error = nullptr;
+    if (sqlite3_exec(db, sql.c_str(), nullptr, nullptr, &error) != SQLITE_OK) {
+        NS_FATAL_ERROR("Results database " << results_db << ": " << error);
+    }
+}
+
+sqlite3_stmt* db_prepare(const std::string& sql) {
+    sqlite3_stmt* stmt;
+    NS_ABORT_MSG_IF(sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK,
+                    "Results database " << results_db << ": " << sqlite3_errmsg(db));
+    return stmt;
+}
+
+void db_step(sqlite3_stmt* stmt) {
+    NS_ABORT_MSG_IF(sqlite3_step(stmt) != SQLITE_DONE, "Results database " << results_db << ": "
+                    << sqlite3_errmsg(db));
+    sqlite3_reset(stmt);
+}
+
+std::string db_text(sqlite3_stmt* stmt, int column) {
+    return reinterpret_cast<const char*>(sqlite3_column_text(stmt, column));
+}
+
+// Opens the results database, creating the tables on first use. A cell is only complete once its row in
+// cells exists, flows and queue delays of cells that were cut short are dropped here.
+void open_results_db() {
+    NS_ABORT_MSG_IF(sqlite3_open(results_db.c_str(), &db) != SQLITE_OK,
+                    "Cannot open results database " << results_db);
+    sqlite3_busy_timeout(db, 10000);
+    db_exec("PRAGMA journal_mode = WAL;"
+            "CREATE TABLE IF NOT EXISTS cells (config_hash INTEGER PRIMARY KEY, experiment TEXT NOT NULL, "
+            "run INTEGER NOT NULL, config TEXT NOT NULL, deterministic INTEGER NOT NULL, "
+            "finished TEXT NOT NULL DEFAULT CURRENT_TIMESTAMP);"
+            "CREATE INDEX IF NOT EXISTS cells_by_experiment ON cells (experiment, run);"
+            "CREATE TABLE IF NOT EXISTS flows (config_hash INTEGER NOT NULL, flow INTEGER NOT NULL, "
+            "src TEXT NOT NULL, dst TEXT NOT NULL, src_port INTEGER NOT NULL, dst_port INTEGER NOT NULL, "
+            "tx_bytes INTEGER NOT NULL, rx_bytes INTEGER NOT NULL, first_tx REAL NOT NULL, last_rx REAL NOT NULL, "
+            "throughput REAL NOT NULL, time_taken REAL NOT NULL, PRIMARY KEY (config_hash, flow)) WITHOUT ROWID;"
+            "CREATE TABLE IF NOT EXISTS queue_delays (config_hash INTEGER NOT NULL, queue INTEGER NOT NULL, "
+            "class TEXT NOT NULL, total INTEGER NOT NULL, max_ns INTEGER NOT NULL, buckets TEXT NOT NULL, "
+            "PRIMARY KEY (config_hash, queue, class)) WITHOUT ROWID;"
+            "CREATE TABLE IF NOT EXISTS fairness (config_hash INTEGER NOT NULL, flow INTEGER NOT NULL, "
+            "jain_index REAL NOT NULL, convergence REAL NOT NULL, throughput_sd REAL NOT NULL, "
+            "PRIMARY KEY (config_hash, flow)) WITHOUT ROWID;"
+            "CREATE VIEW IF NOT EXISTS flow_results AS SELECT cells.experiment, cells.run + 1 AS run, "
+            "flows.flow + 1 AS flow, src, dst, src_port, dst_port, tx_bytes, rx_bytes, first_tx, last_rx, "
+            "throughput, time_taken, cells.config FROM cells JOIN flows USING (config_hash);"
+            "DELETE FROM flows WHERE config_hash NOT IN (SELECT config_hash FROM cells);"
+            "DELETE FROM queue_delays WHERE config_hash NOT IN (SELECT config_hash FROM cells);"
+            "DELETE FROM fairness WHERE config_hash NOT IN (SELECT config_hash FROM cells);");
+    // Resolved before the workers fork, so a missing version is warned about once
+    ns3_version();
+}
+
+void close_results_db() {
+    sqlite3_close(db);
+    db = nullptr;
+}
+
+// Whether the cell can be read back instead of simulated. Traces and FlowMonitor dumps are not stored,
+// so cells are simulated again when they are requested.
+bool cell_stored(size_t experiment, uint32_t run) {
+    if (rerun || trace_interval.IsStrictlyPositive() || flowmon_xml) {
+        return false;
+    }
+    sqlite3_stmt* stmt = db_prepare("SELECT 1 FROM cells WHERE config_hash = ?");
+    sqlite3_bind_int64(stmt, 1, cell_hash(experiment, run));
+    bool stored = sqlite3_step(stmt) == SQLITE_ROW;
+    sqlite3_finalize(stmt);
+    return stored;
+}
+
+// Drops whatever is stored for a cell about to be simulated
+void forget_cell(size_t experiment, uint32_t run) {
+    for (const char* table : {"cells", "flows", "queue_delays", "fairness"}) {
+        sqlite3_stmt* stmt = db_prepare(std::string("DELETE FROM ") + table + " WHERE config_hash = ?");
+        sqlite3_bind_int64(stmt, 1, cell_hash(experiment, run));
+        db_step(stmt);
+        sqlite3_finalize(stmt);
+    }
+}
+
+// Stores one line reported for a simulated cell. The done line of a cell adds its row to cells and
+// commits everything stored for it.
+void store_line(const std::string& line) {
+    std::vector<std::string> fields = split_csv(line);
+    sqlite3_stmt* stmt;
+    if (fields[0] == "done") {
+        size_t experiment = std::stoul(fields[1]);
+        uint32_t run = std::stoul(fields[2]);
+        stmt = db_prepare("INSERT INTO cells (config_hash, experiment, run, config, deterministic) "
+                          "VALUES (?, ?, ?, ?, ?)");
+        sqlite3_bind_int64(stmt, 1, cell_hash(experiment, run));
+        sqlite3_bind_text(stmt, 2, experiments[experiment].name.c_str(), -1, SQLITE_TRANSIENT);
+        sqlite3_bind_int(stmt, 3, run);
+        sqlite3_bind_text(stmt, 4, describe_cell(experiment, run).c_str(), -1, SQLITE_TRANSIENT);
+        sqlite3_bind_int(stmt, 5, fields[3] == "1");
+        db_step(stmt);
+        sqlite3_finalize(stmt);
+        db_exec("COMMIT; BEGIN");
+        return;
+    }
+
+    if (fields[0] == "fairness") {
+        stmt = db_prepare("INSERT INTO fairness VALUES (?, ?, ?, ?, ?)");
+        sqlite3_bind_int64(stmt, 1, cell_hash(std::stoul(fields[1]), std::stoul(fields[2])));
+        sqlite3_bind_int(stmt, 2, std::stoul(fields[3]));
+        for (int column = 3; column < 6; column++) {
+            sqlite3_bind_double(stmt, column, std::stod(fields[column + 1]));
+        }
+    } else if (fields[0] == "qdelay") {
+        stmt = db_prepare("INSERT INTO queue_delays VALUES (?, ?, ?, ?, ?, ?)");
+        sqlite3_bind_int64(stmt, 1, cell_hash(std::stoul(fields[1]), std::stoul(fields[2])));
+        sqlite3_bind_int(stmt, 2, std::stoul(fields[3]));
+        sqlite3_bind_text(stmt, 3, fields[4].c_str(), -1, SQLITE_TRANSIENT);
+        sqlite3_bind_int64(stmt, 4, std::stoll(fields[5]));
+        sqlite3_bind_int64(stmt, 5, std::stoll(fields[6]));
+        sqlite3_bind_text(stmt, 6, fields[7].c_str(), -1, SQLITE_TRANSIENT);
+    } else {
+        stmt = db_prepare("INSERT INTO flows VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?)");
+        sqlite3_bind_int64(stmt, 1, cell_hash(std::stoul(fields[0]), std::stoul(fields[1])));
+        sqlite3_bind_int(stmt, 2, std::stoul(fields[2]));
+        sqlite3_bind_text(stmt, 3, fields[3].c_str(), -1, SQLITE_TRANSIENT);
+        sqlite3_bind_text(stmt, 4, fields[4].c_str(), -1, SQLITE_TRANSIENT);
+        sqlite3_bind_int(stmt, 5, std::stoul(fields[5]));
+        sqlite3_bind_int(stmt, 6, std::stoul(fields[6]));
+        sqlite3_bind_int64(stmt, 7, std::stoll(fields[7]));
+        sqlite3_bind_int64(stmt, 8, std::stoll(fields[8]));
+        for (int column = 9; column < 13; column++) {
+            sqlite3_bind_double(stmt, column, std::stod(fields[column]));
+        }
+    }
+    db_step(stmt);
+    sqlite3_finalize(stmt);
+}
+
+// Hands the stored flows, queue delays and fairness metrics of a cell to on_line in the form the workers report them,
+// followed by its done line
+void replay_cell(size_t experiment, uint32_t run, const std::function<void(const std::string&)>& on_line) {
+    int64_t hash = cell_hash(experiment, run);
+    std::string cell = std::to_string(experiment) + "," + std::to_string(run) + ",";
+
+    sqlite3_stmt* stmt = db_prepare("SELECT flow, src, dst, src_port, dst_port, tx_bytes, rx_bytes, first_tx, "
+                                    "last_rx, throughput, time_taken FROM flows WHERE config_hash = ? ORDER BY flow");
+    sqlite3_bind_int64(stmt, 1, hash);
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+        std::ostringstream out;
+        out.precision(17);
+        out << cell << sqlite3_column_int(stmt, 0) << "," << db_text(stmt, 1) << "," << db_text(stmt, 2) << ","
+            << sqlite3_column_int(stmt, 3) << "," << sqlite3_column_int(stmt, 4) << ","
+            << sqlite3_column_int64(stmt, 5) << "," << sqlite3_column_int64(stmt, 6);
+        for (int column = 7; column < 11; column++) {
+            out << "," << sqlite3_column_double(stmt, column);
+        }
+        on_line(out.str());
+    }
+    sqlite3_finalize(stmt);
+
+    stmt = db_prepare("SELECT queue, class, total, max_ns, buckets FROM queue_delays WHERE config_hash = ?");
+    sqlite3_bind_int64(stmt, 1, hash);
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+        on_line("qdelay," + cell + std::to_string(sqlite3_column_int(stmt, 0)) + "," + db_text(stmt, 1) + "," +
+                std::to_string(sqlite3_column_int64(stmt, 2)) + "," + std::to_string(sqlite3_column_int64(stmt, 3)) +
+                "," + db_text(stmt, 4));
+    }
+    sqlite3_finalize(stmt);
+
+    stmt = db_prepare("SELECT flow, jain_index, convergence, throughput_sd FROM fairness WHERE config_hash = ?");
+    sqlite3_bind_int64(stmt, 1, hash);
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+        std::ostringstream out;
+        out.precision(17);
+        out << "fairness," << cell << sqlite3_column_int(stmt, 0);
+        for (int column = 1; column < 4; column++) {
+            out << "," << sqlite3_column_double(stmt, column);
+        }
+        on_line(out.str());
+    }
+    sqlite3_finalize(stmt);
+
+    stmt = db_prepare("SELECT deterministic FROM cells WHERE config_hash = ?");
+    sqlite3_bind_int64(stmt, 1, hash);
+    NS_ABORT_MSG_IF(sqlite3_step(stmt) != SQLITE_ROW, "Cell " << hash << " is not stored");
+    on_line("done," + cell + std::to_string(sqlite3_column_int(stmt, 0)));
+    sqlite3_finalize(stmt);
+}
+
+// Runs and results of one experiment as seen by the parent. Runs are started in order, so the runs
+// started so far are 0..started-1. Flows of a workload differ from run to run, so there the metrics are
+// the mean FCT of every size bucket, collected per run in run_fct until the run is done.
+struct ExperimentProgress {
+    uint32_t started = 0;
+    uint32_t finished = 0;
+    bool deterministic = false;
+    std::vector<RunningStats> throughput, fct;
+    std::map<uint32_t, std::vector<RunningStats>> run_fct;
+};
+
+// Whether the confidence interval of the metric is narrow enough to stop adding runs
+bool ci_converged(const RunningStats& stats) {
+    return ci_half_width(stats) <= ci_target * std::abs(stats.mean);
+}
+
+// Runs needed to bring the confidence interval of the metric below the target, estimated from the
+// current standard deviation and at least one more than done so far
+uint32_t runs_needed(const RunningStats& stats) {
+    if (ci_converged(stats)) {
+        return stats.n;
+    }
+    if (stats.mean == 0) {
+        return max_runs;
+    }
+    double runs = pow(t_quantile_95(stats.n - 1) * running_sd(stats) / (ci_target * std::abs(stats.mean)), 2);
+    return std::max(stats.n + 1, (uint32_t)std::min<double>(ceil(runs), max_runs));
+}
+
+// Whether the cell that just ran drew no random numbers. Step marking never does and RED only once its
+// average queue reaches MinTh, which configure_network sets in bytes with aggregation like peak_queue.
+// FqCoDel hashes flows with a random perturbation and PIE marks at random.
+bool seed_independent(const AqmSpec& aqm) {
+    if (aqm.disc == "step") {
+        return true;
+    }
+    return aqm.disc == "red" && peak_queue < aqm.min_th * (queue_in_bytes() ? packet_bytes : 1);
+}
+
+// Runs every cell in the worker pool and hands each reported flow and queue delay line to on_line as soon
+// as it arrives. Cells found in the results database are read back instead, new ones are stored.
+// Without --adaptive every experiment runs the number of runs of its spec. With it, each experiment starts
+// with one run and stops there if the run was seed-independent; otherwise it gets min_runs runs, then
+// further batches sized from the observed variance until every metric has converged or max_runs is reached.
+// The time the simulated cells spent building their network is reported apart from the simulation itself.
+void run_cells_in_parallel(const std::function<void(const std::string&)>& on_line) {
+    std::vector<ExperimentProgress> progress(experiments.size());
+    CellTiming total = {0, 0, 0, 0, 0};
+    uint32_t simulated = 0;
+    std::vector<std::pair<size_t, uint32_t>> cells;
+    std::deque<size_t> pending;
+
+    auto plan = [&](size_t experiment, uint32_t target) {
+        ExperimentProgress& p = progress[experiment];
+        for (; p.started < target; p.started++) {
+            pending.push_back(cells.size());
+            cells.push_back({experiment, p.started});
+        }
+    };
+
+    for (size_t experiment = 0; experiment < experiments.size(); experiment++) {
+        const ExperimentSpec& spec = experiments[experiment];
+        progress[experiment].throughput.resize(spec.flows.size());
+        progress[experiment].fct.resize(spec.workload.flows > 0 ? fct_buckets : spec.flows.size());
+        plan(experiment, adaptive ? 1 : experiments[experiment].runs);
+    }
+
+    // Called with the last batch of runs of the experiment finished
+    auto replan = [&](size_t experiment) {
+        ExperimentProgress& p = progress[experiment];
+        if (p.deterministic) {
+            return;
+        }
+        uint32_t target = std::max(p.started, min_runs);
+        if (p.started >= min_runs) {
+            for (const RunningStats& stats : p.throughput) {
+                target = std::max(target, runs_needed(stats));
+            }
+            for (const RunningStats& stats : p.fct) {
+                // Buckets no flow of the workload fell into have nothing to converge
+                if (stats.n > 0) {
+                    target = std::max(target, runs_needed(stats));
+                }
+            }
+        }
+        target = std::min(target, max_runs);
+        if (target > p.started) {
+            std::cout << "Experiment " << experiments[experiment].name << ": " << p.finished
+                      << " runs done, running " << target - p.started << " more" << std::endl;
+        }
+        plan(experiment, target);
+    };
+
+    auto handle_line = [&](const std::string& line) {
+        std::vector<std::string> fields = split_csv(line);
+        if (fields[0] == "qdelay" || fields[0] == "fairness") {
+            on_line(line);
+            return;
+        }
+        if (fields[0] != "done") {
+            NS_ABORT_MSG_IF(fields.size() != 13, "Malformed worker output: " << line);
+            ExperimentProgress& p = progress[std::stoul(fields[0])];
+            if (experiments[std::stoul(fields[0])].workload.flows > 0) {
+                std::vector<RunningStats>& buckets = p.run_fct[std::stoul(fields[1])];
+                buckets.resize(fct_buckets);
+                running_add(buckets[fct_bucket(std::stoull(fields[8]))], std::stod(fields[12]));
+            } else {
+                running_add(p.throughput[std::stoul(fields[2])], std::stod(fields[11]));
+                running_add(p.fct[std::stoul(fields[2])], std::stod(fields[12]));
+            }
+            on_line(line);
+            return;
+        }
+
+        size_t experiment = std::stoul(fields[1]);
+        ExperimentProgress& p = progress[experiment];
+        auto run_fct = p.run_fct.find(std::stoul(fields[2]));
+        if (run_fct != p.run_fct.end()) {
+            for (size_t bucket = 0; bucket < fct_buckets; bucket++) {
+                if (run_fct->second[bucket].n > 0) {
+                    running_add(p.fct[bucket], run_fct->second[bucket].mean);
+                }
+            }
+            p.run_fct.erase(run_fct);
+        }
+        p.finished++;
+        p.deterministic = p.deterministic || fields[3] == "1";
+
+        // Cells read back from the database carry no timing
+        if (fields.size() == 7) {
+            total.setup += std::stod(fields[4]);
+            total.routing += std::stod(fields[5]);
+            total.run += std::stod(fields[6]);
+            simulated++;
+        }
+        if (adaptive && p.finished == p.started) {
+            replan(experiment);
+        }
+    };
+
+    run_workers([&](size_t& cell, std::string& label) {
+        // Cells already in the results database are read back in place, which may plan further cells
+        while (!pending.empty() && cell_stored(cells[pending.front()].first, cells[pending.front()].second)) {
+            auto [experiment, run] = cells[pending.front()];
+            pending.pop_front();
+            replay_cell(experiment, run, handle_line);
+        }
+        if (pending.empty()) {
+            return false;
+        }
+        cell = pending.front();
+        pending.pop_front();
+        forget_cell(cells[cell].first, cells[cell].second);
+        label = "Experiment " + experiments[cells[cell].first].name + " run " + std::to_string(cells[cell].second + 1);
+        return true;
+    }, workers, [&](size_t cell, int fd) {
+        auto [experiment, run] = cells[cell];
+        CellTiming timing;
+        run_cell(experiment, run, fd, &timing);
+
+        // The end of the run, after all its flows: done,experiment,run,deterministic,setup_s,routing_s,run_s
+        const ExperimentSpec& spec = experiments[experiment];
+        bool deterministic = spec.workload.flows == 0 && seed_independent(spec.aqm);
+        std::ostringstream out;
+        out << "done," << experiment << "," << run << "," << (deterministic ? "1" : "0") << "," << timing.setup
+            << "," << timing.routing << "," << timing.run << "\n";
+        report_line(fd, out.str());
+    }, [&](const std::string& line) {
+        store_line(line);
+        handle_line(line);
+    });
+
+    if (simulated > 0) {
+        std::cout << "Simulated " << simulated << " runs: setup " << total.setup << " s, route setup (" << routing
+                  << ") " << total.routing << " s, simulation " << total.run << " s" << std::endl;
+    }
+
+    experiment_deterministic.clear();
+    for (const ExperimentProgress& p : progress) {
+        experiment_deterministic.push_back(p.deterministic);
+    }
+}
+
+// Simulates the first run not yet in the results database, split across all MPI ranks, and reads the cells
+// before it back from there. ns-3 cannot simulate a second distributed cell in the same process since
+// Simulator::Destroy tears down its MPI state, so every mpirun simulates one cell and rank 0 returns the
+// number of runs still missing. Rank 0 hands the gathered (or stored) flow and queue delay lines to on_line
+// and prints the timing of the cell, to compare with the sequential simulator (mpirun -np 1).
+uint32_t run_cells_distributed(const std::function<void(const std::string&)>& on_line) {
+    bool simulated = false;
+    uint32_t missing = 0;
+    for (size_t experiment = 0; experiment < experiments.size(); experiment++) {
+        for (uint32_t run = 0; run < experiments[experiment].runs; run++) {
+            // Only rank 0 has the results database, the other ranks follow its decision until the cell is done
+            int stored = mpi_rank == 0 && cell_stored(experiment, run);
+            if (simulated) {
+                missing += !stored;
+                continue;
+            }
+#ifdef NS3_MPI
+            MPI_Bcast(&stored, 1, MPI_INT, 0, MpiInterface::GetCommunicator());
+#endif
+            if (stored) {
+                if (mpi_rank == 0) {
+                    replay_cell(experiment, run, [&](const std::string& line) {
+                        if (line.compare(0, 5, "done,") != 0) {
+                            on_line(line);
+                        }
+                    });
+                }
+                continue;
+            }
+
+            CellTiming timing;
+            run_cell(experiment, run, -1, &timing);
+            simulated = true;
+            if (mpi_rank != 0) {
+                return 0;
+            }
+
+            // Lines are stored and passed on as the workers would report them, without the newline
+            auto report = [&](std::string line) {
+                line.pop_back();
+                store_line(line);
+                on_line(line);
+            };
+            forget_cell(experiment, run);
+            for (size_t flow = 0; flow < flows.size(); flow++) {
+                if (flows[flow].rx_bytes < flows[flow].target_bytes) {
+                    std::cerr << "Experiment " << experiments[experiment].name << " run " << run + 1 << ": flow "
+                              << flow + 1 << " received only " << flows[flow].rx_bytes << " bytes" << std::endl;
+                }
+                report(flow_line(flow));
+            }
+            for (size_t i = 0; i < delay_histograms.size(); i++) {
+                if (queue_delay && delay_histograms[i].total > 0) {
+                    report(queue_delay_line(i));
+                }
+            }
+            store_line("done," + std::to_string(experiment) + "," + std::to_string(run) + ",0");
+            std::cout << "Experiment " << experiments[experiment].name << " run " << run + 1 << " on " << mpi_size
+                      << " ranks (setup_s,routing_s,run_s,post_s,events,events_per_s,peak_rss_kb): "
+                      << format_timing(timing) << std::endl;
+        }
+    }
+    return missing;
+}
+
+// Benchmarks time the scenario alone. The queue delay hooks run on every packet and the fairness sampling
+// schedules events of its own, so a benchmark worker turns both off before its cells.
+void disable_instrumentation() {
+    queue_delay = false;
+    fairness_interval = Seconds(0);
+}
+
+// Builds the topology at one size (senders for the dumbbell, k for the fabrics), sends bytes from every
+// source and reports size,nodes,flows followed by the cell timing
+void run_topology_benchmark(uint32_t size, uint64_t bytes, int out_fd) {
+    disable_instrumentation();
+    if (topology == "dumbbell") {
+        num_sources = size;
+    } else {
+        fabric_k = size;
+    }
+    size_topology();
+
+    ExperimentSpec spec;
+    spec.name = "bench";
+    for (uint32_t i = 0; i < num_sources; i++) {
+        spec.flows.push_back({i, i % num_destinations, "TcpDctcp", bytes});
+    }
+
+    // The worker owns its copy of the matrix, so the benchmark runs as its only experiment
+    experiments = {spec};
+    CellTiming timing;
+    run_cell(0, 0, -1, &timing);
+
+    std::ostringstream out;
+    out << size << "," << source.GetN() + destination.GetN() + router.GetN() << "," << spec.flows.size() << ","
+        << format_timing(timing) << "\n";
+    report_line(out_fd, out.str());
+}
+
+// Benchmarks the topology at every size in the comma separated list, one size at a time so the timings
+// do not compete for cores, and writes one row per size
+void run_topology_benchmarks(const std::string& sizes, uint64_t bytes) {
+    std::vector<uint32_t> values;
+    std::vector<std::string> labels;
+    for (const std::string& size : split_csv(sizes)) {
+        values.push_back(std::stoul(size));
+        labels.push_back("Benchmark of " + topology + " size " + size);
+    }
+
+    std::ofstream outputFile("tcp_hchench_adlapp_topology_bench.csv");
+    outputFile << "topology,routing,size,nodes,flows,setup_s,routing_s,run_s,post_s,events,events_per_s,peak_rss_kb\n";
+
+    // Flows report nothing, only the benchmark line comes back
+    run_workers(labels, 1, [&](size_t task, int fd) {
+        run_topology_benchmark(values[task], bytes, fd);
+    }, [&](const std::string& line) {
+        outputFile << topology << "," << routing << "," << line << "\n";
+        std::cout << topology << " " << routing << " " << line << std::endl;
+    });
+    outputFile.close();
+}
+
+// Runs the first run of every experiment under each scheduler and writes one row per (scheduler, experiment).
+// Workers run one at a time so the timings do not compete for cores. Rows whose run time grew by more than
+// tolerance percent over the same row of a baseline file from an earlier benchmark count as regressions.
+size_t run_scheduler_benchmarks(const std::string& schedulers, const std::string& baseline_file, double tolerance) {
+    std::vector<std::pair<std::string, size_t>> tasks;
+    std::vector<std::string> labels;
+    for (const std::string& scheduler : split_csv(schedulers)) {
+        TypeId tid;
+        NS_ABORT_MSG_IF(!TypeId::LookupByNameFailSafe("ns3::" + scheduler + "Scheduler", &tid),
+                        "Unknown scheduler " << scheduler);
+        for (size_t experiment = 0; experiment < experiments.size(); experiment++) {
+            tasks.push_back({scheduler, experiment});
+            labels.push_back("Benchmark of experiment " + experiments[experiment].name + " with " + scheduler);
+        }
+    }
+
+    // Run time of every (scheduler, experiment) row of the baseline
+    std::map<std::pair<std::string, std::string>, double> baseline;
+    if (!baseline_file.empty()) {
+        std::ifstream in(baseline_file);
+        NS_ABORT_MSG_IF(!in, "Cannot open benchmark baseline " << baseline_file);
+        std::string line;
+        std::getline(in, line);
+        while (std::getline(in, line)) {
+            std::vector<std::string> fields = split_csv(line);
+            baseline[{fields[0], fields[1]}] = std::stod(fields[5]);
+        }
+    }
+
+    std::ofstream outputFile("tcp_hchench_adlapp_benchmark.csv");
+    outputFile << "scheduler,exp,flows,setup_s,routing_s,run_s,post_s,events,events_per_s,peak_rss_kb,wall_s,"
+               << "baseline_run_s,change_pct\n";
+
+    size_t regressions = 0;
+    std::map<std::string, std::pair<double, std::string>> fastest;
+
+    run_workers(labels, 1, [&](size_t task, int fd) {
+        ObjectFactory factory;
+        factory.SetTypeId("ns3::" + tasks[task].first + "Scheduler");
+        Simulator::SetScheduler(factory);
+        disable_instrumentation();
+
+        const ExperimentSpec& spec = experiments[tasks[task].second];
+        auto start = std::chrono::steady_clock::now();
+        CellTiming timing;
+        run_cell(tasks[task].second, 0, -1, &timing);
+        double wall_time = seconds_since(start);
+
+        std::ostringstream out;
+        out << tasks[task].first << "," << spec.name << "," << std::max<size_t>(spec.flows.size(), spec.workload.flows)
+            << "," << format_timing(timing) << "," << wall_time << "\n";
+        report_line(fd, out.str());
+    }, [&](const std::string& line) {
+        std::vector<std::string> fields = split_csv(line);
+        double run_time = std::stod(fields[5]);
+        outputFile << line << ",";
+
+        auto it = baseline.find({fields[0], fields[1]});
+        if (it != baseline.end()) {
+            double change = (run_time - it->second) / it->second * 100;
+            outputFile << it->second << "," << change;
+            if (change > tolerance) {
+                regressions++;
+                std::cout << "Regression: experiment " << fields[1] << " with " << fields[0] << " is " << change
+                          << "% slower than the baseline" << std::endl;
+            }
         } else {
-            // Experiment 5
-            tputsexp5.push_back(curr_throughput);
-            ftimeexp5.push_back(time_taken);
-            std::cout << "exp5 -thpt link 1 - " << curr_throughput << std::endl;
-            std::cout << "exp5-time link 1 - " << time_taken << std::endl;
-            
-            FlowMonitor::FlowStats fs = stats[flowid + 1];
-            flowid += 2;
-            time_taken = fs.timeLastRxPacket.GetSeconds() - fs.timeFirstTxPacket.GetSeconds();
-            curr_throughput = fs.rxBytes * 8.0 / time_taken / (1024 * 1024);
-            tputs2exp5.push_back(curr_throughput);
-            ftime2exp5.push_back(time_taken);
-            std::cout << "exp5 -thpt link 2 - " << curr_throughput << std::endl;
-            std::cout << "exp5-time link 2 - " << time_taken << std::endl;
-        }
-        flowid += 2;
-    }
-    monitor->SerializeToXmlFile("ns3simulator.flowmon", true, true);
-}
-
-void calculate_statistics(const std::vector<double>& tputsexp1, const std::vector<double>& tputsexp2,
-                        const std::vector<double>& tputs2exp2, const std::vector<double>& tputsexp3,
-                        const std::vector<double>& tputsexp4, const std::vector<double>& tputs2exp4,
-                        const std::vector<double>& tputsexp5, const std::vector<double>& tputs2exp5,
-                        const std::vector<double>& ftimeexp1, const std::vector<double>& ftimeexp2,
-                        const std::vector<double>& ftime2exp2, const std::vector<double>& ftimeexp3,
-                        const std::vector<double>& ftimeexp4, const std::vector<double>& ftime2exp4,
-                        const std::vector<double>& ftimeexp5, const std::vector<double>& ftime2exp5,
-                        float th_means[], float th_sds[], float afct_means[], float afct_sds[]) {
-    // Calculate means of throughput
-    th_means[1] = (tputsexp1[1] + tputsexp1[2] + tputsexp1[0]) / 3;
-    th_means[2] = (tputsexp2[1] + tputsexp2[2] + tputsexp2[0]) / 3;
-    th_means[3] = (tputs2exp2[1] + tputs2exp2[2] + tputs2exp2[0]) / 3;
-    th_means[4] = (tputsexp3[1] + tputsexp3[2] + tputsexp3[0]) / 3;
-    th_means[5] = (tputsexp4[1] + tputsexp4[2] + tputsexp4[0]) / 3;
-    th_means[6] = (tputs2exp4[1] + tputs2exp4[2] + tputs2exp4[0]) / 3;
-    th_means[7] = (tputsexp5[1] + tputsexp5[2] + tputsexp5[0]) / 3;
-    th_means[8] = (tputs2exp5[1] + tputs2exp5[2] + tputs2exp5[0]) / 3;
-
-    // Calculate standard deviations of throughput
-    th_sds[1] = calculate_sd(tputsexp1[1], tputsexp1[2], tputsexp1[0]);
-    th_sds[2] = calculate_sd(tputsexp2[1], tputsexp2[2], tputsexp2[0]);
-    th_sds[3] = calculate_sd(tputs2exp2[1], tputs2exp2[2], tputs2exp2[0]);
-    th_sds[4] = calculate_sd(tputsexp3[1], tputsexp3[2], tputsexp3[0]);
-    th_sds[5] = calculate_sd(tputsexp4[1], tputsexp4[2], tputsexp4[0]);
-    th_sds[6] = calculate_sd(tputs2exp4[1], tputs2exp4[2], tputs2exp4[0]);
-    th_sds[7] = calculate_sd(tputsexp5[1], tputsexp5[2], tputsexp5[0]);
-    th_sds[8] = calculate_sd(tputs2exp5[1], tputs2exp5[2], tputs2exp5[0]);
-
-    // Calculate means of average flow completion time
-    afct_means[1] = (ftimeexp1[1] + ftimeexp1[2] + ftimeexp1[0]) / 3;
-    afct_means[2] = (ftimeexp2[1] + ftimeexp2[2] + ftimeexp2[0]) / 3;
-    afct_means[3] = (ftime2exp2[1] + ftime2exp2[2] + ftime2exp2[0]) / 3;
-    afct_means[4] = (ftimeexp3[1] + ftimeexp3[2] + ftimeexp3[0]) / 3;
-    afct_means[5] = (ftimeexp4[1] + ftimeexp4[2] + ftimeexp4[0]) / 3;
-    afct_means[6] = (ftime2exp4[1] + ftime2exp4[2] + ftime2exp4[0]) / 3;
-    afct_means[7] = (ftimeexp5[1] + ftimeexp5[2] + ftimeexp5[0]) / 3;
-    afct_means[8] = (ftime2exp5[1] + ftime2exp5[2] + ftime2exp5[0]) / 3;
-
-    // Calculate standard deviations of average flow completion time
-    afct_sds[1] = calculate_sd(ftimeexp1[1], ftimeexp1[2], ftimeexp1[0]);
-    afct_sds[2] = calculate_sd(ftimeexp2[1], ftimeexp2[2], ftimeexp2[0]);
-    afct_sds[3] = calculate_sd(ftime2exp2[1], ftime2exp2[2], ftime2exp2[0]);
-    afct_sds[4] = calculate_sd(ftimeexp3[1], ftimeexp3[2], ftimeexp3[0]);
-    afct_sds[5] = calculate_sd(ftimeexp4[1], ftimeexp4[2], ftimeexp4[0]);
-    afct_sds[6] = calculate_sd(ftime2exp4[1], ftime2exp4[2], ftime2exp4[0]);
-    afct_sds[7] = calculate_sd(ftimeexp5[1], ftimeexp5[2], ftimeexp5[0]);
-    afct_sds[8] = calculate_sd(ftime2exp5[1], ftime2exp5[2], ftime2exp5[0]);
-}
-
-void write_output(const std::vector<double>& tputsexp1, const std::vector<double>& tputsexp2,
-                 const std::vector<double>& tputs2exp2, const std::vector<double>& tputsexp3,
-                 const std::vector<double>& tputsexp4, const std::vector<double>& tputs2exp4,
-                 const std::vector<double>& tputsexp5, const std::vector<double>& tputs2exp5,
-                 const std::vector<double>& ftimeexp1, const std::vector<double>& ftimeexp2,
-                 const std::vector<double>& ftime2exp2, const std::vector<double>& ftimeexp3,
-                 const std::vector<double>& ftimeexp4, const std::vector<double>& ftime2exp4,
-                 const std::vector<double>& ftimeexp5, const std::vector<double>& ftime2exp5,
-                 const float th_means[], const float th_sds[], 
-                 const float afct_means[], const float afct_sds[]) {
+            outputFile << ",";
+        }
+        outputFile << "\n";
+
+        auto best = fastest.find(fields[1]);
+        if (best == fastest.end() || run_time < best->second.first) {
+            fastest[fields[1]] = {run_time, fields[0]};
+        }
+        std::cout << "exp" << fields[1] << " " << fields[0] << " - run " << run_time << " s, "
+                  << fields[8] << " events/s" << std::endl;
+    });
+    outputFile.close();
+
+    for (const auto& entry : fastest) {
+        std::cout << "exp" << entry.first << " fastest scheduler - " << entry.second.second << std::endl;
+    }
+    return regressions;
+}
+
+// Simulates the first run of every experiment at packet level and with segment_aggregation, compares the
+// mean throughput and completion time of every flow (of every size bucket for workloads) and the wall-clock
+// time, and writes tcp_hchench_adlapp_aggregation.csv. Returns the number of flows off by more than
+// tolerance percent in either metric.
+size_t run_aggregation_validation(double tolerance) {
+    uint32_t aggregation = segment_aggregation;
+    std::vector<std::string> labels;
+    for (size_t experiment = 0; experiment < experiments.size(); experiment++) {
+        for (uint32_t mode : {1u, aggregation}) {
+            labels.push_back("Aggregation check of experiment " + experiments[experiment].name + " with " +
+                             std::to_string(mode) + " segments per packet");
+        }
+    }
+
+    // Throughput and completion time by experiment, flow and aggregation, and run time and events by
+    // experiment and aggregation
+    std::map<std::tuple<size_t, std::string, uint32_t>, std::pair<RunningStats, RunningStats>> metrics;
+    std::map<std::pair<size_t, uint32_t>, std::pair<double, uint64_t>> timings;
+
+    // One worker at a time, so lines arrive task by task and every task ends with its timing line
+    size_t task_done = 0;
+    run_workers(labels, 1, [&](size_t task, int fd) {
+        segment_aggregation = task % 2 ? aggregation : 1;
+        CellTiming timing;
+        run_cell(task / 2, 0, fd, &timing);
+        report_line(fd, "timing," + std::to_string(task / 2) + "," + std::to_string(segment_aggregation) + "," +
+                        format_timing(timing) + "\n");
+    }, [&](const std::string& line) {
+        std::vector<std::string> fields = split_csv(line);
+        if (fields[0] == "qdelay" || fields[0] == "fairness") {
+            return;
+        }
+        if (fields[0] == "timing") {
+            timings[{std::stoul(fields[1]), std::stoul(fields[2])}] = {std::stod(fields[5]), std::stoull(fields[7])};
+            task_done++;
+            return;
+        }
+
+        size_t experiment = std::stoul(fields[0]);
+        std::string flow = experiments[experiment].workload.flows > 0
+                               ? fct_bucket_names[fct_bucket(std::stoull(fields[8]))]
+                               : "s" + std::to_string(std::stoul(fields[2]) + 1);
+        auto& metric = metrics[{experiment, flow, task_done % 2 ? aggregation : 1}];
+        running_add(metric.first, std::stod(fields[11]));
+        running_add(metric.second, std::stod(fields[12]));
+    });
+
+    std::ofstream outputFile("tcp_hchench_adlapp_aggregation.csv");
+    outputFile << "exp,flow,thpt_packet,thpt_aggregate,thpt_err_pct,fct_packet,fct_aggregate,fct_err_pct,"
+               << "within_tolerance,run_s_packet,run_s_aggregate,speedup,events_packet,events_aggregate\n";
+
+    size_t failures = 0;
+    for (const auto& [key, packet] : metrics) {
+        auto [experiment, flow, mode] = key;
+        auto aggregate = metrics.find({experiment, flow, aggregation});
+        if (mode != 1 || aggregate == metrics.end()) {
+            continue;
+        }
+        double th_err = (aggregate->second.first.mean - packet.first.mean) / packet.first.mean * 100;
+        double fct_err = (aggregate->second.second.mean - packet.second.mean) / packet.second.mean * 100;
+        bool within = std::abs(th_err) <= tolerance && std::abs(fct_err) <= tolerance;
+        failures += within ? 0 : 1;
+
+        auto packet_time = timings[{experiment, 1}];
+        auto aggregate_time = timings[{experiment, aggregation}];
+        outputFile << experiments[experiment].name << "," << flow << "," << packet.first.mean << ","
+                   << aggregate->second.first.mean << "," << th_err << "," << packet.second.mean << ","
+                   << aggregate->second.second.mean << "," << fct_err << "," << (within ? 1 : 0) << ","
+                   << packet_time.first << "," << aggregate_time.first << ","
+                   << packet_time.first / aggregate_time.first << "," << packet_time.second << ","
+                   << aggregate_time.second << "\n";
+        std::cout << "exp" << experiments[experiment].name << " " << flow << " - throughput " << th_err
+                  << "%, completion time " << fct_err << "%, " << packet_time.first / aggregate_time.first
+                  << "x faster" << std::endl;
+    }
+    outputFile.close();
+    return failures;
+}
+
+// One row per flow per run, keyed by the 5-tuple of the flow within its cell
+struct FlowResult {
+    uint32_t experiment;
+    uint32_t run;
+    uint32_t flow;
+    Ipv4FlowClassifier::FiveTuple tuple;
+    uint64_t bytes;
+    double throughput;
+    double time_taken;
+
+    // Fairness metrics, only for experiments with several fixed flows
+    bool fairness;
+    double jain_index;
+    double convergence;
+    double throughput_sd;
+};
+
+struct MetricSummary {
+    RunningStats stats;
+    double p5, p50, p95;
+};
+
+// Statistics over the runs of one flow of one experiment, the runs are results[first, first + count)
+struct FlowSummary {
+    uint32_t experiment;
+    uint32_t flow;
+    Ipv4FlowClassifier::FiveTuple tuple;
+    size_t first;
+    size_t count;
+    MetricSummary th;
+    MetricSummary afct;
+    bool fairness;
+    MetricSummary jain_index;
+    MetricSummary convergence;
+    MetricSummary throughput_sd;
+};
+
+// Queueing delay histograms of every experiment, bottleneck queue and traffic class, merged over the runs
+typedef std::map<std::tuple<uint32_t, uint32_t, std::string>, DelayHistogram> QueueDelays;
+
+// Adds a histogram reported by a worker to the one of its experiment, queue and class
+void merge_queue_delay(const std::vector<std::string>& fields, QueueDelays& delays) {
+    NS_ABORT_MSG_IF(fields.size() != 8, "Malformed queue delay output");
+    DelayHistogram& histogram = delays[{std::stoul(fields[1]), std::stoul(fields[3]), fields[4]}];
+    histogram.counts.resize(hist_buckets);
+    histogram.total += std::stoull(fields[5]);
+    histogram.max_ns = std::max<uint64_t>(histogram.max_ns, std::stoull(fields[6]));
+
+    std::istringstream buckets(fields[7]);
+    std::string bucket;
+    while (buckets >> bucket) {
+        size_t colon = bucket.find(':');
+        histogram.counts.at(std::stoul(bucket.substr(0, colon))) += std::stoull(bucket.substr(colon + 1));
+    }
+}
+
+// Reads the per-run results of the fixed flows of the given cells back from the results database. The
+// flows of workloads stay in the database, write_fct_percentiles aggregates them there, so the memory of
+// the parent does not grow with the size of the workload. The given cells are listed in the temporary
+// table current_cells for the queries that follow.
+void load_results(const std::set<std::pair<uint32_t, uint32_t>>& cells, std::vector<FlowResult>& results) {
+    db_exec("CREATE TEMP TABLE IF NOT EXISTS current_cells (config_hash INTEGER PRIMARY KEY, "
+            "experiment INTEGER NOT NULL); DELETE FROM current_cells");
+    sqlite3_stmt* insert = db_prepare("INSERT INTO current_cells VALUES (?, ?)");
+    for (auto [experiment, run] : cells) {
+        sqlite3_bind_int64(insert, 1, cell_hash(experiment, run));
+        sqlite3_bind_int(insert, 2, experiment);
+        db_step(insert);
+    }
+    sqlite3_finalize(insert);
+
+    sqlite3_stmt* stmt = db_prepare("SELECT flow, src, dst, src_port, dst_port, rx_bytes, throughput, time_taken, "
+                                    "jain_index, convergence, throughput_sd FROM flows LEFT JOIN fairness "
+                                    "USING (config_hash, flow) WHERE config_hash = ?");
+    for (auto [experiment, run] : cells) {
+        if (experiments[experiment].workload.flows > 0) {
+            continue;
+        }
+        sqlite3_bind_int64(stmt, 1, cell_hash(experiment, run));
+        while (sqlite3_step(stmt) == SQLITE_ROW) {
+            FlowResult result;
+            result.experiment = experiment;
+            result.run = run;
+            result.flow = sqlite3_column_int(stmt, 0);
+            result.tuple.sourceAddress = Ipv4Address(db_text(stmt, 1).c_str());
+            result.tuple.destinationAddress = Ipv4Address(db_text(stmt, 2).c_str());
+            result.tuple.protocol = 6;
+            result.tuple.sourcePort = sqlite3_column_int(stmt, 3);
+            result.tuple.destinationPort = sqlite3_column_int(stmt, 4);
+            result.bytes = sqlite3_column_int64(stmt, 5);
+            result.throughput = sqlite3_column_double(stmt, 6);
+            result.time_taken = sqlite3_column_double(stmt, 7);
+            result.fairness = sqlite3_column_type(stmt, 8) != SQLITE_NULL;
+            result.jain_index = sqlite3_column_double(stmt, 8);
+            result.convergence = sqlite3_column_double(stmt, 9);
+            result.throughput_sd = sqlite3_column_double(stmt, 10);
+            results.push_back(result);
+        }
+        sqlite3_reset(stmt);
+    }
+    sqlite3_finalize(stmt);
+}
+
+// Returns the number of runs a distributed simulation still has to simulate in later mpiruns, 0 when the
+// results are complete
+uint32_t collect_and_analyze_data(std::vector<FlowResult>& results, QueueDelays& delays) {
+    // Finished flows are written to disk as they arrive and stored in the results database, the per-run
+    // results are read back from there once every cell is done
+    std::ofstream flowsFile(flows_file);
+    flowsFile << "exp,run,flow,src,dst,src_port,dst_port,tx_bytes,rx_bytes,first_tx,last_rx,throughput,time_taken\n";
+    std::set<std::pair<uint32_t, uint32_t>> cells;
+
+    auto on_line = [&](const std::string& line) {
+        std::vector<std::string> fields = split_csv(line);
+        if (fields[0] == "qdelay") {
+            merge_queue_delay(fields, delays);
+            return;
+        }
+        // Read back with the flows once the cells are done
+        if (fields[0] == "fairness") {
+            return;
+        }
+        NS_ABORT_MSG_IF(fields.size() != 13, "Malformed worker output: " << line);
+
+        uint32_t experiment = std::stoul(fields[0]);
+        uint32_t run = std::stoul(fields[1]);
+        const std::string& name = experiments[experiment].name;
+        flowsFile << name << line.substr(line.find(',')) << "\n";
+        cells.insert({experiment, run});
+
+        // Workloads finish thousands of flows, they are only summarized per size bucket
+        if (experiments[experiment].workload.flows > 0) {
+            return;
+        }
+        std::cout << "exp" << name << " run " << run + 1 << " -thpt link " << std::stoul(fields[2]) + 1
+                  << " - " << std::stod(fields[11]) << std::endl;
+        std::cout << "exp" << name << " run " << run + 1 << " -time link " << std::stoul(fields[2]) + 1
+                  << " - " << std::stod(fields[12]) << std::endl;
+    };
+
+    // Every finished cell is committed on its own, so an interrupted run loses only its unfinished cells
+    db_exec("BEGIN");
+    uint32_t missing = 0;
+    if (mpi) {
+        missing = run_cells_distributed(on_line);
+    } else {
+        run_cells_in_parallel(on_line);
+    }
+    db_exec("COMMIT");
+    flowsFile.close();
+    load_results(cells, results);
+
+    // Keep the runs of each flow of each experiment next to each other
+    std::sort(results.begin(), results.end(), [](const FlowResult& a, const FlowResult& b) {
+        return std::tie(a.experiment, a.flow, a.run) < std::tie(b.experiment, b.flow, b.run);
+    });
+    return missing;
+}
+
+// Mean and variance are accumulated run by run, the percentiles need the runs sorted
+MetricSummary summarize(std::vector<double>& values) {
+    MetricSummary summary;
+    for (double v : values) {
+        running_add(summary.stats, v);
+    }
+    std::sort(values.begin(), values.end());
+    summary.p5 = percentile(values, 5);
+    summary.p50 = percentile(values, 50);
+    summary.p95 = percentile(values, 95);
+    return summary;
+}
+
+void calculate_statistics(const std::vector<FlowResult>& results, std::vector<FlowSummary>& summaries) {
+    for (size_t first = 0; first < results.size();) {
+        size_t last = first;
+
+        // Flows of a workload with the same index have nothing in common across runs
+        if (experiments[results[first].experiment].workload.flows > 0) {
+            while (last < results.size() && results[last].experiment == results[first].experiment) {
+                last++;
+            }
+            first = last;
+            continue;
+        }
+
+        std::vector<double> tputs, ftimes, jain, convergence, tput_sds;
+        while (last < results.size() && results[last].experiment == results[first].experiment &&
+               results[last].flow == results[first].flow) {
+            tputs.push_back(results[last].throughput);
+            ftimes.push_back(results[last].time_taken);
+            if (results[last].fairness) {
+                jain.push_back(results[last].jain_index);
+                convergence.push_back(results[last].convergence);
+                tput_sds.push_back(results[last].throughput_sd);
+            }
+            last++;
+        }
+
+        FlowSummary summary;
+        summary.experiment = results[first].experiment;
+        summary.flow = results[first].flow;
+        summary.tuple = results[first].tuple;
+        summary.first = first;
+        summary.count = last - first;
+
+        // Statistics of throughput and average flow completion time
+        summary.th = summarize(tputs);
+        summary.afct = summarize(ftimes);
+
+        // Fairness, convergence time and short-term throughput variation of flows that competed
+        summary.fairness = !jain.empty();
+        if (summary.fairness) {
+            summary.jain_index = summarize(jain);
+            summary.convergence = summarize(convergence);
+            summary.throughput_sd = summarize(tput_sds);
+        }
+        summaries.push_back(summary);
+
+        first = last;
+    }
+}
+
+void write_output(const std::vector<FlowResult>& results, const std::vector<FlowSummary>& summaries) {
     // Open output file for writing
     std::ofstream outputFile("tcp_hchench_adlapp.csv");
 
+    // One group of columns per flow, wide enough for the experiment with the most runs and flows
+    size_t run_columns = 0;
+    size_t max_flows = 0;
+    for (const ExperimentSpec& spec : experiments) {
+        max_flows = std::max(max_flows, spec.flows.size());
+    }
+    for (const FlowSummary& summary : summaries) {
+        run_columns = std::max(run_columns, summary.count);
+    }
+
     // Create proper headers 
-    outputFile << "exp,r1_s1,r2_s1,r3_s1,avg_s1,std_s1,unit_s1,r1_s2,r2_s2,r3_s2,avg_s2,std_s2,unit_s2,\n";
-
-    // Write data for throughput - experiment 1
-    outputFile << "th_1," << tputsexp1[0] << "," << tputsexp1[1] << "," << tputsexp1[2] << "," 
-               << th_means[1] << "," << th_sds[1] << "," << "Mbps," << ",,,,,,\n";
-
-    // Write data for throughput - experiment 2
-    outputFile << "th_2," << tputsexp2[0] << "," << tputsexp2[1] << "," << tputsexp2[2] << "," 
-               << th_means[2] << "," << th_sds[2] << "," << "Mbps," << tputs2exp2[0] << "," 
-               << tputs2exp2[1] << "," << tputs2exp2[2] << "," << th_means[3] << "," << th_sds[3] << ",Mbps,\n";
-
-    // Write data for throughput - experiment 3
-    outputFile << "th_3," << tputsexp3[0] << "," << tputsexp3[1] << "," << tputsexp3[2] << "," 
-               << th_means[4] << "," << th_sds[4] << "," << "Mbps," << ",,,,,,\n";
-
-    // Write data for throughput - experiment 4
-    outputFile << "th_4," << tputsexp4[0] << "," << tputsexp4[1] << "," << tputsexp4[2] << "," 
-               << th_means[5] << "," << th_sds[5] << "," << "Mbps," << tputs2exp4[0] << "," 
-               << tputs2exp4[1] << "," << tputs2exp4[2] << "," << th_means[6] << "," << th_sds[6] << ",Mbps,\n";
-
-    // Write data for throughput - experiment 5
-    outputFile << "th_5," << tputsexp5[0] << "," << tputsexp5[1] << "," << tputsexp5[2] << "," 
-               << th_means[7] << "," << th_sds[7] << "," << "Mbps," << tputs2exp5[0] << "," 
-               << tputs2exp5[1] << "," << tputs2exp5[2] << "," << th_means[8] << "," << th_sds[8] << ",Mbps,\n";
-
-    // Write data for average flow completion time - experiment 1
-    outputFile << "afct_1," << ftimeexp1[0] << "," << ftimeexp1[1] << "," << ftimeexp1[2] << "," 
-               << afct_means[1] << "," << afct_sds[1] << "," << "sec," << ",,,,,,\n";
-
-    // Write data for average flow completion time - experiment 2
-    outputFile << "afct_2," << ftimeexp2[0] << "," << ftimeexp2[1] << "," << ftimeexp2[2] << "," 
-               << afct_means[2] << "," << afct_sds[2] << "," << "sec," << ftime2exp2[0] << "," 
-               << ftime2exp2[1] << "," << ftime2exp2[2] << "," << afct_means[3] << "," << afct_sds[3] << ",sec,\n";
-
-    // Write data for average flow completion time - experiment 3
-    outputFile << "afct_3," << ftimeexp3[0] << "," << ftimeexp3[1] << "," << ftimeexp3[2] << "," 
-               << afct_means[4] << "," << afct_sds[4] << "," << "sec," << ",,,,,,\n";
-
-    // Write data for average flow completion time - experiment 4
-    outputFile << "afct_4," << ftimeexp4[0] << "," << ftimeexp4[1] << "," << ftimeexp4[2] << "," 
-               << afct_means[5] << "," << afct_sds[5] << "," << "sec," << ftime2exp4[0] << "," 
-               << ftime2exp4[1] << "," << ftime2exp4[2] << "," << afct_means[6] << "," << afct_sds[6] << ",sec,\n";
-
-    // Write data for average flow completion time - experiment 5
-    outputFile << "afct_5," << ftimeexp5[0] << "," << ftimeexp5[1] << "," << ftimeexp5[2] << "," 
-               << afct_means[7] << "," << afct_sds[7] << "," << "sec," << ftime2exp5[0] << "," 
-               << ftime2exp5[1] << "," << ftime2exp5[2] << "," << afct_means[8] << "," << afct_sds[8] << ",sec,\n";
+    outputFile << "exp,";
+    for (size_t flow = 1; flow <= max_flows; flow++) {
+        for (size_t run = 1; run <= run_columns; run++) {
+            outputFile << "r" << run << "_s" << flow << ",";
+        }
+        outputFile << "avg_s" << flow << ",std_s" << flow << ",unit_s" << flow << ",";
+    }
+    outputFile << "\n";
+
+    // Summaries are sorted by experiment and flow
+    std::vector<std::vector<const FlowSummary*>> by_experiment(experiments.size());
+    for (const FlowSummary& summary : summaries) {
+        by_experiment[summary.experiment].push_back(&summary);
+    }
+
+    // Write data for throughput and then average flow completion time of every experiment, followed by
+    // the fairness metrics of the experiments whose flows competed. Jain's index is the same for every flow
+    // of a run, so it is only given with the first.
+    struct OutputMetric {
+        const char* prefix;
+        const char* unit;
+        double FlowResult::*run_value;
+        MetricSummary FlowSummary::*summary;
+        bool fairness;
+        bool first_flow_only;
+    };
+    const OutputMetric metrics[] = {
+        {"th_", "Mbps", &FlowResult::throughput, &FlowSummary::th, false, false},
+        {"afct_", "sec", &FlowResult::time_taken, &FlowSummary::afct, false, false},
+        {"jfi_", "index", &FlowResult::jain_index, &FlowSummary::jain_index, true, true},
+        {"conv_", "sec", &FlowResult::convergence, &FlowSummary::convergence, true, false},
+        {"thsd_", "Mbps", &FlowResult::throughput_sd, &FlowSummary::throughput_sd, true, false},
+    };
+    for (const OutputMetric& metric : metrics) {
+        for (size_t experiment = 0; experiment < experiments.size(); experiment++) {
+            if (experiments[experiment].workload.flows > 0) {
+                continue;
+            }
+            if (metric.fairness && (by_experiment[experiment].empty() || !by_experiment[experiment][0]->fairness)) {
+                continue;
+            }
+            outputFile << metric.prefix << experiments[experiment].name << ",";
+            for (size_t flow = 0; flow < max_flows; flow++) {
+                if (flow >= by_experiment[experiment].size() || (metric.first_flow_only && flow > 0)) {
+                    outputFile << std::string(run_columns + 3, ',');
+                    continue;
+                }
+
+                const FlowSummary& summary = *by_experiment[experiment][flow];
+                for (size_t run = 0; run < run_columns; run++) {
+                    if (run < summary.count) {
+                        outputFile << results[summary.first + run].*metric.run_value;
+                    }
+                    outputFile << ",";
+                }
+                const RunningStats& stats = (summary.*metric.summary).stats;
+                outputFile << stats.mean << "," << running_sd(stats) << "," << metric.unit << ",";
+            }
+            outputFile << "\n";
+        }
+    }
     
     // Close output file
     outputFile.close();
 }
 
+// One row per metric of every flow: the runs it got, mean, sample standard deviation, 95% confidence
+// interval of the mean and its half-width relative to the mean, percentiles over the runs and whether the
+// interval met the adaptive target (or the experiment was seed-independent)
+void write_statistics(const std::vector<FlowSummary>& summaries) {
+    std::ofstream statsFile("tcp_hchench_adlapp_stats.csv");
+    statsFile << "exp,flow,src,dst,src_port,dst_port,metric,unit,runs,mean,sd,ci95_low,ci95_high,ci_rel_half_width,"
+                 "p5,p50,p95,converged\n";
+
+    for (const FlowSummary& summary : summaries) {
+        bool deterministic = summary.experiment < experiment_deterministic.size() &&
+                             experiment_deterministic[summary.experiment];
+        std::vector<std::pair<const char*, const MetricSummary*>> metrics = {
+            {"throughput,Mbps,", &summary.th}, {"fct,sec,", &summary.afct}};
+        if (summary.fairness) {
+            metrics.push_back({"jain_index,index,", &summary.jain_index});
+            metrics.push_back({"convergence,sec,", &summary.convergence});
+            metrics.push_back({"throughput_sd,Mbps,", &summary.throughput_sd});
+        }
+        for (const auto& [name, metric] : metrics) {
+            const RunningStats& stats = metric->stats;
+
+            // A seed-independent run has no spread, otherwise a single run says nothing about it
+            double half = deterministic ? 0 : ci_half_width(stats);
+            statsFile << experiments[summary.experiment].name << "," << summary.flow + 1 << ","
+                      << summary.tuple.sourceAddress << "," << summary.tuple.destinationAddress << ","
+                      << summary.tuple.sourcePort << "," << summary.tuple.destinationPort << "," << name
+                      << stats.n << "," << stats.mean << "," << running_sd(stats) << ",";
+            if (std::isfinite(half)) {
+                statsFile << stats.mean - half << "," << stats.mean + half << ","
+                          << (stats.mean != 0 ? half / std::abs(stats.mean) : 0) << ",";
+            } else {
+                statsFile << ",,,";
+            }
+            statsFile << metric->p5 << "," << metric->p50 << "," << metric->p95 << ","
+                      << (half <= ci_target * std::abs(stats.mean) ? 1 : 0) << "\n";
+        }
+    }
+    statsFile.close();
+}
+
+// FCT over the flows of all runs of every workload, by flow-size bucket. Counted and averaged in the
+// results database, of the sorted completion times only the two around each percentile are read. Returns the
+// p99 FCT of every bucket of every experiment, NaN for buckets without flows and experiments without a workload.
+std::vector<std::vector<double>> write_fct_percentiles() {
+    std::vector<std::vector<double>> p99(experiments.size(),
+                                         std::vector<double>(fct_buckets, std::numeric_limits<double>::quiet_NaN()));
+    // The bucket of a flow as fct_bucket picks it
+    std::string bucket_of = "CASE";
+    for (size_t i = 0; i + 1 < fct_buckets; i++) {
+        bucket_of += " WHEN rx_bytes <= " + std::to_string(fct_bucket_limits[i]) + " THEN " + std::to_string(i);
+    }
+    bucket_of += " ELSE " + std::to_string(fct_buckets - 1) + " END";
+    std::string bucket_flows = "FROM flows JOIN current_cells USING (config_hash) WHERE experiment = ?1 AND " +
+                               bucket_of + " = ?2";
+    sqlite3_stmt* totals = db_prepare("SELECT COUNT(*), AVG(time_taken), MAX(time_taken) " + bucket_flows);
+    sqlite3_stmt* ranked = db_prepare("SELECT time_taken " + bucket_flows + " ORDER BY time_taken LIMIT 2 OFFSET ?3");
+
+    // Interpolates between the two completion times around the rank like percentile, reading only those
+    auto bucket_percentile = [&](size_t experiment, size_t i, uint64_t count, double p) {
+        double rank = p / 100 * (count - 1);
+        uint64_t lower = floor(rank);
+        sqlite3_bind_int(ranked, 1, experiment);
+        sqlite3_bind_int(ranked, 2, i);
+        sqlite3_bind_int64(ranked, 3, lower);
+        NS_ABORT_MSG_IF(sqlite3_step(ranked) != SQLITE_ROW, "Results database " << results_db << ": "
+                        << sqlite3_errmsg(db));
+        double low = sqlite3_column_double(ranked, 0);
+        double high = sqlite3_step(ranked) == SQLITE_ROW ? sqlite3_column_double(ranked, 0) : low;
+        sqlite3_reset(ranked);
+        return low + (rank - lower) * (high - low);
+    };
+
+    std::ofstream fctFile("tcp_hchench_adlapp_fct.csv");
+    fctFile << "exp,tcp,load,cdf,minth,maxth,bucket,flows,mean,p50,p95,p99,max\n";
+    for (size_t experiment = 0; experiment < experiments.size(); experiment++) {
+        const WorkloadSpec& wl = experiments[experiment].workload;
+        const AqmSpec& aqm = experiments[experiment].aqm;
+        if (wl.flows == 0) {
+            continue;
+        }
+        for (size_t bucket = 0; bucket < fct_buckets; bucket++) {
+            sqlite3_bind_int(totals, 1, experiment);
+            sqlite3_bind_int(totals, 2, bucket);
+            NS_ABORT_MSG_IF(sqlite3_step(totals) != SQLITE_ROW, "Results database " << results_db << ": "
+                            << sqlite3_errmsg(db));
+            uint64_t count = sqlite3_column_int64(totals, 0);
+            double mean = sqlite3_column_double(totals, 1);
+            double max = sqlite3_column_double(totals, 2);
+            sqlite3_reset(totals);
+
+            fctFile << experiments[experiment].name << "," << wl.tcp_variant << "," << wl.load << ","
+                    << wl.cdf_name << "," << aqm.min_th << "," << aqm.max_th << "," << fct_bucket_names[bucket] << ","
+                    << count << ",";
+            if (count == 0) {
+                fctFile << ",,,,\n";
+                continue;
+            }
+            p99[experiment][bucket] = bucket_percentile(experiment, bucket, count, 99);
+            fctFile << mean << "," << bucket_percentile(experiment, bucket, count, 50) << ","
+                    << bucket_percentile(experiment, bucket, count, 95) << "," << p99[experiment][bucket] << ","
+                    << max << "\n";
+        }
+    }
+    fctFile.close();
+    sqlite3_finalize(totals);
+    sqlite3_finalize(ranked);
+    return p99;
+}
+
+// Queueing delay percentiles of every bottleneck queue and traffic class, in microseconds. Queues are
+// numbered like the time-series traces: r1 to r2 then r2 to r1 in the dumbbell, one per receiver in the fabrics.
+void write_queue_delays(const QueueDelays& delays) {
+    std::ofstream delayFile("tcp_hchench_adlapp_qdelay.csv");
+    delayFile << "exp,queue,class,packets,p50_us,p99_us,p999_us,max_us\n";
+    for (const auto& [key, histogram] : delays) {
+        delayFile << experiments[std::get<0>(key)].name << ",q" << std::get<1>(key) + 1 << "," << std::get<2>(key)
+                  << "," << histogram.total << "," << hist_percentile(histogram, 0.5) / 1e3 << ","
+                  << hist_percentile(histogram, 0.99) / 1e3 << "," << hist_percentile(histogram, 0.999) / 1e3
+                  << "," << histogram.max_ns / 1e3 << "\n";
+    }
+    delayFile.close();
+}
+
+// Ranks the configurations of an AQM sweep by the mean throughput and mean completion time of the fixed flows
+// of all their experiments, by the p99 FCT of the short (0-10KB) flows of their workloads and by the 99th
+// percentile queueing delay over all their bottleneck queues. Equal values share a rank, configurations
+// without a value come last, and a metric no configuration has is left out. The overall rank orders the
+// configurations by their average rank in the metrics they are ranked by.
+void write_sweep_ranking(const std::vector<FlowSummary>& summaries, const QueueDelays& delays,
+                         const std::vector<std::vector<double>>& fct_p99) {
+    struct ConfigScore {
+        std::string name;
+        std::string options;
+        RunningStats throughput, fct, short_fct;
+        DelayHistogram delay;
+        double score = 0;
+    };
+    std::vector<ConfigScore> configs;
+    std::map<std::string, size_t> index;
+    for (const ExperimentSpec& spec : experiments) {
+        if (index.insert({spec.sweep_config, configs.size()}).second) {
+            configs.push_back({spec.sweep_config, describe_aqm(spec.aqm), RunningStats(), RunningStats(),
+                               RunningStats(), DelayHistogram(), 0});
+            configs.back().delay.counts.assign(hist_buckets, 0);
+        }
+    }
+
+    for (const FlowSummary& summary : summaries) {
+        ConfigScore& config = configs[index[experiments[summary.experiment].sweep_config]];
+        running_add(config.throughput, summary.th.stats.mean);
+        running_add(config.fct, summary.afct.stats.mean);
+    }
+    for (size_t experiment = 0; experiment < experiments.size(); experiment++) {
+        if (!std::isnan(fct_p99[experiment][0])) {
+            running_add(configs[index[experiments[experiment].sweep_config]].short_fct, fct_p99[experiment][0]);
+        }
+    }
+    for (const auto& [key, histogram] : delays) {
+        ConfigScore& config = configs[index[experiments[std::get<0>(key)].sweep_config]];
+        for (size_t bucket = 0; bucket < hist_buckets; bucket++) {
+            config.delay.counts[bucket] += histogram.counts[bucket];
+        }
+        config.delay.total += histogram.total;
+        config.delay.max_ns = std::max(config.delay.max_ns, histogram.max_ns);
+    }
+
+    // Value of every metric, NaN where the configuration has none
+    const double none = std::numeric_limits<double>::quiet_NaN();
+    auto throughput = [&](const ConfigScore& c) { return c.throughput.n > 0 ? c.throughput.mean : none; };
+    auto fct = [&](const ConfigScore& c) { return c.fct.n > 0 ? c.fct.mean : none; };
+    auto short_fct = [&](const ConfigScore& c) { return c.short_fct.n > 0 ? c.short_fct.mean : none; };
+    auto delay_p99 = [&](const ConfigScore& c) {
+        return c.delay.total > 0 ? (double)hist_percentile(c.delay, 0.99) : none;
+    };
+
+    // Rank 1 is the best in every metric
+    auto rank_by = [&](const std::function<double(const ConfigScore&)>& metric, bool higher_is_better) {
+        std::vector<double> value(configs.size());
+        for (size_t i = 0; i < configs.size(); i++) {
+            value[i] = metric(configs[i]);
+        }
+        auto better = [&](size_t a, size_t b) {
+            if (std::isnan(value[a]) || std::isnan(value[b])) {
+                return !std::isnan(value[a]) && std::isnan(value[b]);
+            }
+            return higher_is_better ? value[a] > value[b] : value[a] < value[b];
+        };
+        std::vector<size_t> order(configs.size());
+        std::iota(order.begin(), order.end(), 0);
+        std::stable_sort(order.begin(), order.end(), better);
+        std::vector<size_t> rank(configs.size());
+        for (size_t i = 0; i < order.size(); i++) {
+            rank[order[i]] = i > 0 && !better(order[i - 1], order[i]) ? rank[order[i - 1]] : i + 1;
+        }
+        return rank;
+    };
+    auto ranked = [&](const std::function<double(const ConfigScore&)>& metric) {
+        return std::any_of(configs.begin(), configs.end(),
+                           [&](const ConfigScore& c) { return !std::isnan(metric(c)); });
+    };
+    std::vector<std::pair<std::function<double(const ConfigScore&)>, bool>> metrics = {
+        {throughput, true}, {fct, false}, {short_fct, false}, {delay_p99, false}};
+    std::vector<std::vector<size_t>> ranks;
+    size_t used = 0;
+    for (const auto& [metric, higher_is_better] : metrics) {
+        ranks.push_back(rank_by(metric, higher_is_better));
+        if (ranked(metric)) {
+            used++;
+            for (size_t i = 0; i < configs.size(); i++) {
+                configs[i].score += ranks.back()[i];
+            }
+        }
+    }
+    for (ConfigScore& c : configs) {
+        c.score = used > 0 ? c.score / used : 0;
+    }
+    std::vector<size_t> overall = rank_by([](const ConfigScore& c) { return c.score; }, false);
+
+    std::vector<size_t> order(configs.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return overall[a] < overall[b]; });
+
+    // Metrics a configuration has no value for are left empty, and so is their rank when no configuration has
+    // a value
+    auto field = [](double value) {
+        std::ostringstream out;
+        if (!std::isnan(value)) {
+            out << value;
+        }
+        return out.str();
+    };
+    std::ofstream sweepFile("tcp_hchench_adlapp_sweep.csv");
+    sweepFile << "rank,config,options,throughput_mbps,fct_s,short_fct_p99_s,qdelay_p50_us,qdelay_p99_us,"
+              << "throughput_rank,fct_rank,short_fct_rank,qdelay_rank,score\n";
+    for (size_t i : order) {
+        const ConfigScore& c = configs[i];
+        sweepFile << overall[i] << "," << c.name << "," << c.options << "," << field(throughput(c)) << ","
+                  << field(fct(c)) << "," << field(short_fct(c)) << ","
+                  << field(c.delay.total > 0 ? hist_percentile(c.delay, 0.5) / 1e3 : none) << ","
+                  << field(delay_p99(c) / 1e3);
+        for (size_t m = 0; m < metrics.size(); m++) {
+            sweepFile << "," << (ranked(metrics[m].first) ? std::to_string(ranks[m][i]) : "");
+        }
+        sweepFile << "," << c.score << "\n";
+        std::cout << "sweep rank " << overall[i] << " - " << c.name << " (" << c.options << ")" << std::endl;
+    }
+    sweepFile.close();
+}
+
+// Fluid model of the fixed flows of an experiment, fast enough to screen thousands of configurations
+// before simulating the promising ones packet by packet. Queues hold fractional packets and every flow
+// sends its window per round trip. Windows change once per round trip from the marks expected in that
+// round, in the same way the TCP variants react to a window of ACKs. Fabric links are taken to be free, so
+// only sender and receiver links and the dumbbell bottleneck queue. Host egress queues never mark.
+
+// One-way delay of every link, as configured in configure_network
+const double fluid_link_delay = 0.25e-3;
+
+// ns-3 defaults the model follows: RED starts with a maximum marking probability of 1/LInterm that Feng's
+// adaptation divides by FengAlpha below MinTh and multiplies by FengBeta above MaxTh. BIC's window
+// parameters are in segments.
+const double red_initial_max_p = 1.0 / 50;
+const double feng_alpha = 3, feng_beta = 2;
+const double bic_beta = 0.8, bic_max_increment = 16, bic_low_window = 14, bic_smooth_part = 5, bic_b = 4;
+
+// A link in stage i is the i-th link of every path that uses it
+struct FluidLink {
+    size_t stage;
+    bool aqm;
+    bool watched;
+    double queue = 0;
+    double avg = 0;
+    double max_p = red_initial_max_p;
+    int feng_status = 0;
+    double mark = 0;
+    std::vector<double> queued = {};
+
+    // Time integral and peak of the queue, and packet-weighted integral of its delay
+    double queue_integral = 0;
+    double peak = 0;
+    double arrivals = 0;
+    double delay_integral = 0;
+};
+
+struct FluidFlow {
+    std::string variant;
+    std::vector<size_t> path;
+    double segments;
+    double window = 10;
+    double ssthresh = std::numeric_limits<double>::infinity();
+    double alpha;
+    double w_max = 0;
+    double sent = 0;
+    double delivered = 0;
+    double round_end = 0;
+    double round_sent = 0;
+    double round_marked = 0;
+    double credit = 0;
+    double finish = -1;
+};
+
+// Predicted throughput (Mbps) and completion time of every flow as the packet level measures them, mean
+// and peak occupancy (packets) of the busiest watched queue, mean queueing delay of the packets passing
+// the watched queues, and the wall-clock time of the model
+struct FluidResult {
+    std::vector<double> throughput, fct;
+    double queue_mean = 0;
+    double queue_peak = 0;
+    double delay_mean = 0;
+    double wall_ms;
+};
+
+// Which experiments the model covers
+std::string fluid_unsupported(const ExperimentSpec& spec) {
+    if (spec.workload.flows > 0) {
+        return "workloads are not modelled";
+    }
+    if (spec.aqm.disc != "red" && spec.aqm.disc != "step") {
+        return spec.aqm.disc + " is not modelled";
+    }
+    for (const FlowSpec& flow : spec.flows) {
+        if (flow.tcp_variant != "TcpDctcp" && flow.tcp_variant != "TcpBic" && flow.tcp_variant != "TcpNewReno") {
+            return flow.tcp_variant + " is not modelled";
+        }
+    }
+    return "";
+}
+
+// Marking probability of a switch queue for the packets arriving in the next step. RED follows the average
+// queue with the gentle curve, and marks at 2p/(1+p) on average since it spreads its marks evenly. A full
+// queue drops everything, which the senders see like a mark.
+void update_fluid_marking(FluidLink& link, const AqmSpec& aqm, double arrivals) {
+    if (aqm.disc == "step") {
+        link.mark = link.queue >= aqm.k ? 1 : 0;
+    } else {
+        link.avg = link.queue + (link.avg - link.queue) * pow(1 - aqm.qw, arrivals);
+        int status = link.avg < aqm.min_th ? -1 : (link.avg > aqm.max_th ? 1 : 0);
+        if (status == -1 && link.feng_status != -1) {
+            link.max_p /= feng_alpha;
+        } else if (status == 1 && link.feng_status != 1) {
+            link.max_p *= feng_beta;
+        }
+        link.feng_status = status;
+
+        double p = 0;
+        if (link.avg >= 2 * aqm.max_th) {
+            p = 1;
+        } else if (link.avg >= aqm.max_th) {
+            p = link.max_p + (1 - link.max_p) * (link.avg - aqm.max_th) / aqm.max_th;
+        } else if (link.avg >= aqm.min_th) {
+            p = link.max_p * (link.avg - aqm.min_th) / (aqm.max_th - aqm.min_th);
+        }
+        p = std::min(p, 1.0);
+        link.mark = link.queue > 1 ? 2 * p / (1 + p) : 0;
+    }
+    if (link.queue >= aqm.max_size) {
+        link.mark = 1;
+    }
+}
+
+// Window update at the end of a round trip. A round with marks reduces the window with a probability
+// of one minus e to the minus the expected marks, accumulated so that rounds with a few marks reduce
+// it at the rate they would at packet level.
+void end_fluid_round(FluidFlow& flow, double max_window, double dctcp_g) {
+    if (flow.variant == "TcpDctcp" && flow.round_sent > 0) {
+        flow.alpha = (1 - dctcp_g) * flow.alpha + dctcp_g * flow.round_marked / flow.round_sent;
+    }
+    flow.credit += 1 - exp(-flow.round_marked);
+    if (flow.credit >= 1) {
+        flow.credit -= 1;
+        if (flow.variant == "TcpDctcp") {
+            flow.window *= 1 - flow.alpha / 2;
+        } else if (flow.variant == "TcpBic") {
+            flow.w_max = flow.window < flow.w_max ? bic_beta * flow.window : flow.window;
+            flow.window *= flow.window < bic_low_window ? 0.5 : bic_beta;
+        } else {
+            flow.window /= 2;
+        }
+        flow.window = std::max(flow.window, 2.0);
+        flow.ssthresh = flow.window;
+    } else if (flow.window < flow.ssthresh) {
+        flow.window = std::min(2 * flow.window, flow.ssthresh);
+    } else if (flow.variant == "TcpBic" && flow.window >= bic_low_window) {
+        // Binary search towards the last maximum, then probing above it
+        double increment;
+        if (flow.window < flow.w_max) {
+            double distance = (flow.w_max - flow.window) / bic_b;
+            increment = distance > bic_max_increment ? bic_max_increment
+                                                     : (distance <= 1 ? bic_b / bic_smooth_part : distance);
+        } else if (flow.window < flow.w_max + bic_b) {
+            increment = bic_b / bic_smooth_part;
+        } else if (flow.window < flow.w_max + bic_max_increment * (bic_b - 1)) {
+            increment = (flow.window - flow.w_max) / (bic_b - 1);
+        } else {
+            increment = bic_max_increment;
+        }
+        flow.window += increment;
+    } else {
+        flow.window += 1;
+    }
+    flow.window = std::min(flow.window, max_window);
+    flow.round_sent = 0;
+    flow.round_marked = 0;
+}
+
+FluidResult run_fluid_model(const ExperimentSpec& spec) {
+    auto start = std::chrono::steady_clock::now();
+    double bit_rate = DataRate(link_rate).GetBitRate();
+    double capacity = bit_rate / (8.0 * packet_bytes);
+
+    // Links between sender and receiver, and the round trip of a packet and its ACK without queueing
+    uint32_t hops = topology == "dumbbell" ? 3 : (topology == "leafspine" ? 4 : 6);
+    double base_rtt = 2 * hops * fluid_link_delay + hops * (packet_bytes + 52) * 8.0 / bit_rate;
+
+    // Every flow passes its sender's link, the dumbbell bottleneck and its receiver's link in that order
+    std::vector<FluidLink> links;
+    std::map<uint32_t, size_t> sender_links, receiver_links;
+    size_t last_stage = topology == "dumbbell" ? 2 : 1;
+    if (topology == "dumbbell") {
+        links.push_back({1, true, true});
+    }
+    std::vector<FluidFlow> fluid_flows(spec.flows.size());
+    for (size_t i = 0; i < spec.flows.size(); i++) {
+        const FlowSpec& fs = spec.flows[i];
+        if (!sender_links.count(fs.sender)) {
+            sender_links[fs.sender] = links.size();
+            links.push_back({0, false, false});
+        }
+        if (!receiver_links.count(fs.receiver)) {
+            receiver_links[fs.receiver] = links.size();
+            links.push_back({last_stage, true, topology != "dumbbell"});
+        }
+        fluid_flows[i].variant = fs.tcp_variant;
+        fluid_flows[i].segments = (double)fs.bytes / segment_size;
+        fluid_flows[i].alpha = spec.aqm.dctcp_alpha_init;
+        fluid_flows[i].round_end = base_rtt;
+        fluid_flows[i].path.push_back(sender_links[fs.sender]);
+        if (topology == "dumbbell") {
+            fluid_flows[i].path.push_back(0);
+        }
+        fluid_flows[i].path.push_back(receiver_links[fs.receiver]);
+    }
+    for (FluidLink& link : links) {
+        link.queued.assign(fluid_flows.size(), 0);
+    }
+
+    // Both ends buffer 256KB
+    double max_window = 262144.0 / segment_size;
+    double dt = base_rtt / 100;
+    size_t remaining = fluid_flows.size();
+    double t = 0;
+    std::vector<double> in(fluid_flows.size()), marked(fluid_flows.size()), link_arrivals(links.size());
+
+    for (; remaining > 0; t += dt) {
+        // Offered load of every flow, its window over the round trip including the queues on its path
+        for (size_t f = 0; f < fluid_flows.size(); f++) {
+            FluidFlow& flow = fluid_flows[f];
+            double rtt = base_rtt;
+            double unmarked = 1;
+            for (size_t l : flow.path) {
+                rtt += links[l].queue / capacity;
+                unmarked *= 1 - links[l].mark;
+            }
+            in[f] = std::min(flow.window / rtt * dt, flow.segments - flow.sent);
+            marked[f] = in[f] * (1 - unmarked);
+            flow.sent += in[f];
+            flow.round_sent += in[f];
+            flow.round_marked += marked[f];
+            if (t >= flow.round_end) {
+                end_fluid_round(flow, max_window, spec.aqm.dctcp_g);
+                flow.round_end = t + rtt;
+            }
+        }
+
+        // Every link serves its queue and the new arrivals FIFO, at most capacity * dt, each flow getting
+        // its share of what is waiting. What leaves one link arrives at the next on the path.
+        for (size_t stage = 0; stage <= last_stage; stage++) {
+            std::fill(link_arrivals.begin(), link_arrivals.end(), 0);
+            for (size_t f = 0; f < fluid_flows.size(); f++) {
+                link_arrivals[fluid_flows[f].path[stage]] += in[f];
+            }
+            for (size_t l = 0; l < links.size(); l++) {
+                FluidLink& link = links[l];
+                if (link.stage != stage) {
+                    continue;
+                }
+                double waiting = link.queue + link_arrivals[l];
+                if (waiting > 0) {
+                    // A switch queue drops what does not fit, the senders send it again
+                    double served = std::min(capacity * dt, waiting);
+                    double kept = std::min(waiting - served, link.aqm ? (double)spec.aqm.max_size
+                                                                       : std::numeric_limits<double>::infinity());
+                    link.arrivals += link_arrivals[l];
+                    link.delay_integral += link_arrivals[l] * link.queue / capacity;
+                    for (size_t f = 0; f < fluid_flows.size(); f++) {
+                        if (fluid_flows[f].path[stage] != l) {
+                            continue;
+                        }
+                        double share = (link.queued[f] + in[f]) / waiting;
+                        fluid_flows[f].sent -= share * (waiting - served - kept);
+                        link.queued[f] = share * kept;
+                        in[f] = share * served;
+                    }
+                    link.queue = kept;
+                    link.queue_integral += kept * dt;
+                    link.peak = std::max(link.peak, kept);
+                }
+
+                // RED ages its average over idle time as if packets had arrived at the link rate
+                if (link.aqm) {
+                    update_fluid_marking(link, spec.aqm, link.queue > 0 ? link_arrivals[l] : capacity * dt);
+                }
+            }
+        }
+
+        // The last packet of a flow arrives one way after it left the last queue
+        for (size_t f = 0; f < fluid_flows.size(); f++) {
+            FluidFlow& flow = fluid_flows[f];
+            flow.delivered += in[f];
+            if (flow.finish < 0 && flow.delivered >= flow.segments * (1 - 1e-9)) {
+                flow.finish = t + dt + base_rtt / 2;
+                remaining--;
+            }
+        }
+    }
+
+    FluidResult result;
+    for (const FluidFlow& flow : fluid_flows) {
+        result.fct.push_back(flow.finish);
+        result.throughput.push_back(flow.segments * segment_size * 8.0 / flow.finish / (1024 * 1024));
+    }
+    double arrivals = 0, delay = 0;
+    for (const FluidLink& link : links) {
+        if (!link.watched) {
+            continue;
+        }
+        if (link.queue_integral / t > result.queue_mean) {
+            result.queue_mean = link.queue_integral / t;
+            result.queue_peak = link.peak;
+        }
+        arrivals += link.arrivals;
+        delay += link.delay_integral;
+    }
+    result.delay_mean = arrivals > 0 ? delay / arrivals : 0;
+    result.wall_ms = seconds_since(start) * 1e3;
+    return result;
+}
+
+// Runs the fluid model on every experiment it covers instead of simulating them and writes the predicted
+// flows and queues to tcp_hchench_adlapp_fluid.csv
+void run_fluid_experiments() {
+    std::ofstream outputFile("tcp_hchench_adlapp_fluid.csv");
+    outputFile << "exp,config,flow,tcp,throughput_mbps,fct_s,queue_mean_pkts,queue_peak_pkts,qdelay_mean_us,model_ms\n";
+
+    for (const ExperimentSpec& spec : experiments) {
+        std::string unsupported = fluid_unsupported(spec);
+        if (!unsupported.empty()) {
+            std::cout << "exp" << spec.name << " skipped: " << unsupported << std::endl;
+            continue;
+        }
+        FluidResult result = run_fluid_model(spec);
+        for (size_t flow = 0; flow < spec.flows.size(); flow++) {
+            outputFile << spec.name << "," << spec.sweep_config << ",s" << flow + 1 << ","
+                       << spec.flows[flow].tcp_variant << "," << result.throughput[flow] << "," << result.fct[flow]
+                       << "," << result.queue_mean << "," << result.queue_peak << "," << result.delay_mean * 1e6
+                       << "," << result.wall_ms << "\n";
+        }
+        std::cout << "exp" << spec.name << " fluid model in " << result.wall_ms << " ms" << std::endl;
+    }
+    outputFile.close();
+}
+
+// Simulates the first run of every experiment the fluid model covers and compares the mean throughput and
+// completion time of every flow, and the mean queueing delay of the data packets at the watched
+// bottleneck queues, with the model. Writes tcp_hchench_adlapp_fluid_validation.csv and returns the number
+// of flows off by more than tolerance percent in throughput or completion time.
+size_t run_fluid_validation(double tolerance) {
+    std::vector<size_t> covered;
+    std::vector<std::string> labels;
+    for (size_t experiment = 0; experiment < experiments.size(); experiment++) {
+        std::string unsupported = fluid_unsupported(experiments[experiment]);
+        if (!unsupported.empty()) {
+            std::cout << "exp" << experiments[experiment].name << " skipped: " << unsupported << std::endl;
+            continue;
+        }
+        covered.push_back(experiment);
+        labels.push_back("Fluid model check of experiment " + experiments[experiment].name);
+    }
+
+    std::map<std::pair<size_t, uint32_t>, std::pair<double, double>> packet;
+    std::map<size_t, double> packet_time;
+    QueueDelays delays;
+    run_workers(labels, workers, [&](size_t task, int fd) {
+        CellTiming timing;
+        run_cell(covered[task], 0, fd, &timing);
+        report_line(fd, "timing," + std::to_string(covered[task]) + "," + format_timing(timing) + "\n");
+    }, [&](const std::string& line) {
+        std::vector<std::string> fields = split_csv(line);
+        if (fields[0] == "qdelay") {
+            merge_queue_delay(fields, delays);
+        } else if (fields[0] == "timing") {
+            packet_time[std::stoul(fields[1])] = std::stod(fields[2]) + std::stod(fields[3]) + std::stod(fields[4]);
+        } else if (fields[0] != "fairness") {
+            packet[{std::stoul(fields[0]), std::stoul(fields[2])}] = {std::stod(fields[11]), std::stod(fields[12])};
+        }
+    });
+
+    // Mean delay of the data packets at the watched queues, ACKs have their own class
+    std::map<size_t, std::pair<double, uint64_t>> packet_delay;
+    for (const auto& [key, histogram] : delays) {
+        if (std::get<2>(key) == "ack") {
+            continue;
+        }
+        auto& [sum, count] = packet_delay[std::get<0>(key)];
+        for (size_t bucket = 0; bucket < hist_buckets; bucket++) {
+            sum += (double)histogram.counts[bucket] * hist_value(bucket) / 1e9;
+        }
+        count += histogram.total;
+    }
+
+    std::ofstream outputFile("tcp_hchench_adlapp_fluid_validation.csv");
+    outputFile << "exp,flow,thpt_packet,thpt_fluid,thpt_err_pct,fct_packet,fct_fluid,fct_err_pct,qdelay_packet_us,"
+               << "qdelay_fluid_us,within_tolerance,packet_s,fluid_ms,speedup\n";
+
+    size_t failures = 0;
+    for (size_t experiment : covered) {
+        FluidResult fluid = run_fluid_model(experiments[experiment]);
+        auto [delay_sum, delay_count] = packet_delay[experiment];
+        for (size_t flow = 0; flow < experiments[experiment].flows.size(); flow++) {
+            auto [th, fct] = packet[{experiment, flow}];
+            double th_err = (fluid.throughput[flow] - th) / th * 100;
+            double fct_err = (fluid.fct[flow] - fct) / fct * 100;
+            bool within = std::abs(th_err) <= tolerance && std::abs(fct_err) <= tolerance;
+            failures += within ? 0 : 1;
+
+            outputFile << experiments[experiment].name << ",s" << flow + 1 << "," << th << "," << fluid.throughput[flow]
+                       << "," << th_err << "," << fct << "," << fluid.fct[flow] << "," << fct_err << ",";
+            if (delay_count > 0) {
+                outputFile << delay_sum / delay_count * 1e6;
+            }
+            outputFile << "," << fluid.delay_mean * 1e6 << "," << (within ? 1 : 0) << "," << packet_time[experiment]
+                       << "," << fluid.wall_ms << "," << packet_time[experiment] * 1e3 / fluid.wall_ms << "\n";
+            std::cout << "exp" << experiments[experiment].name << " s" << flow + 1 << " - throughput " << th_err
+                      << "%, completion time " << fct_err << "%, " << packet_time[experiment] * 1e3 / fluid.wall_ms
+                      << "x faster" << std::endl;
+        }
+    }
+    outputFile.close();
+    return failures;
+}
+
 int main(int argc, char *argv[]) {
-    // Network helper classes for configuring point-to-point links and addresses
-    PointToPointHelper pointToPoint;
-    Ipv4AddressHelper address;
+    std::string spec_file;
+    uint32_t runs = 0;
+    std::string benchmark_sizes;
+    uint64_t benchmark_bytes = 1024 * 1024;
+    bool benchmark = false;
+    std::string schedulers = "Map,Heap,List,Calendar,PriorityQueue";
+    std::string benchmark_baseline;
+    double benchmark_tolerance = 10;
+    bool null_message = false;
+    bool validate_aggregation = false;
+    std::string sweep;
+    double aggregation_tolerance = 5;
+    bool fluid = false;
+    bool validate_fluid = false;
+    double fluid_tolerance = 20;
 
-    // Containers to store network interface addresses for the different nodes
-    Ipv4InterfaceContainer i1, i2, i3, i4, i5;
-    
-    // Vectors to store throughput and flow time for multiple experiments
-    std::vector<double> tputsexp1, tputsexp2, tputs2exp2, tputsexp3, tputsexp4, 
-                       tputs2exp4, tputsexp5, tputs2exp5;
-    std::vector<double> ftimeexp1, ftimeexp2, ftime2exp2, ftimeexp3, ftimeexp4, 
-                       ftime2exp4, ftimeexp5, ftime2exp5;
+    CommandLine cmd(__FILE__);
+    cmd.AddValue("spec", "Experiment spec file, the five project experiments are used when empty", spec_file);
+    cmd.AddValue("sweep", "Run the experiments under every queue configuration of a sweep file (or default for the "
+                 "built-in grid) and rank the configurations", sweep);
+    cmd.AddValue("runs", "Number of runs of every experiment, overrides the spec when non-zero", runs);
+    cmd.AddValue("workers", "Number of experiment runs simulated in parallel", workers);
+    cmd.AddValue("adaptive", "Add runs of every experiment until the confidence intervals meet ciTarget "
+                 "instead of using the runs of the spec", adaptive);
+    cmd.AddValue("minRuns", "Runs of an experiment before its confidence intervals are checked", min_runs);
+    cmd.AddValue("maxRuns", "Most runs of an experiment with --adaptive", max_runs);
+    cmd.AddValue("ciTarget", "Half-width of the 95% confidence interval, relative to the mean, at which "
+                 "--adaptive stops adding runs", ci_target);
+    cmd.AddValue("seed", "Base seed for the random number generator", seed);
+    cmd.AddValue("queueDelay", "Record the queueing delay of every packet at the bottleneck queues", queue_delay);
+    cmd.AddValue("flowmonXml", "Also dump full FlowMonitor statistics of every run as XML", flowmon_xml);
+    cmd.AddValue("db", "SQLite database the results of every run are stored in", results_db);
+    cmd.AddValue("ns3Version", "ns-3 release stored with the results, \"unknown\" when ns-3 was built without "
+                 "--enable-build-version and none is given", ns3_release);
+    cmd.AddValue("rerun", "Simulate every run again, even if its configuration is already in the database", rerun);
+    cmd.AddValue("traceInterval", "Sampling interval of the cwnd, DCTCP alpha and bottleneck queue traces, "
+                 "e.g. 100us (off when 0)", trace_interval);
+    cmd.AddValue("fairnessInterval", "Interval of the throughput samples behind Jain's index, convergence time and "
+                 "throughput variation of competing flows (off when 0)", fairness_interval);
+    cmd.AddValue("convergenceBand", "Fraction of the fair share a flow has to stay within to have converged",
+                 convergence_band);
+    cmd.AddValue("linkRate", "Rate of every link", link_rate);
+    cmd.AddValue("aggregation", "Segments sent as one aggregate packet, 1 simulates every packet", segment_aggregation);
+    cmd.AddValue("validateAggregation", "Compare the first run of every experiment with and without --aggregation "
+                 "instead of running the experiments", validate_aggregation);
+    cmd.AddValue("aggregationTolerance", "Difference in throughput or completion time, in percent, reported as "
+                 "a failed validation", aggregation_tolerance);
+    cmd.AddValue("fluid", "Predict the experiments with the fluid model instead of simulating them", fluid);
+    cmd.AddValue("validateFluid", "Compare the fluid model with the first run of every experiment it covers "
+                 "instead of running the experiments", validate_fluid);
+    cmd.AddValue("fluidTolerance", "Difference in throughput or completion time, in percent, reported as a "
+                 "failed fluid model validation", fluid_tolerance);
+    cmd.AddValue("topology", "Network to build: dumbbell, leafspine or fattree", topology);
+    cmd.AddValue("k", "Switch radix of the leafspine and fattree fabrics", fabric_k);
+    cmd.AddValue("routing", "Routes of the network: global, static or nix", routing);
+    cmd.AddValue("senders", "Number of senders of the dumbbell", num_sources);
+    cmd.AddValue("receivers", "Number of receivers of the dumbbell", num_destinations);
+    cmd.AddValue("mpi", "Split every cell across the MPI ranks started by mpirun", mpi);
+    cmd.AddValue("nullMessage", "Synchronize the MPI ranks with null messages instead of global barriers",
+                 null_message);
+    cmd.AddValue("mpiStopTime", "Simulated time every MPI rank stops at, derived from the flows of the run when 0",
+                 mpi_stop_time);
+    cmd.AddValue("benchmarkTopology", "Comma separated topology sizes to benchmark instead of running the experiments "
+                 "(senders for the dumbbell, k for the fabrics)", benchmark_sizes);
+    cmd.AddValue("benchmarkBytes", "Bytes sent by every source in the topology benchmark", benchmark_bytes);
+    cmd.AddValue("benchmark", "Time every experiment under each scheduler instead of running the experiments", benchmark);
+    cmd.AddValue("schedulers", "Comma separated schedulers compared by the benchmark", schedulers);
+    cmd.AddValue("benchmarkBaseline", "Benchmark results of an earlier version to compare against", benchmark_baseline);
+    cmd.AddValue("benchmarkTolerance", "Run time increase over the baseline, in percent, reported as a regression",
+                 benchmark_tolerance);
+    cmd.Parse(argc, argv);
+    NS_ABORT_MSG_IF(adaptive && (min_runs < 2 || max_runs < min_runs),
+                    "--adaptive needs 2 <= minRuns <= maxRuns");
+    NS_ABORT_MSG_IF(segment_aggregation < 1 || packet_bytes * segment_aggregation > 65535,
+                    "--aggregation must be between 1 and " << 65535 / packet_bytes);
+    NS_ABORT_MSG_IF(validate_aggregation && segment_aggregation == 1, "--validateAggregation needs --aggregation");
+    NS_ABORT_MSG_IF(routing != "global" && routing != "static" && routing != "nix",
+                    "Unknown routing " << routing);
 
-    // Arrays used to store statistics for throughput and average flow completion time
-    float th_means[9], th_sds[9], afct_means[9], afct_sds[9];
+    // The simulator implementation has to be chosen before MPI is enabled
+    if (mpi) {
+#ifdef NS3_MPI
+        GlobalValue::Bind("SimulatorImplementationType", StringValue(null_message ? "ns3::NullMessageSimulatorImpl"
+                                                                                  : "ns3::DistributedSimulatorImpl"));
+        MpiInterface::Enable(&argc, &argv);
+        mpi_rank = MpiInterface::GetSystemId();
+        mpi_size = MpiInterface::GetSize();
+#else
+        NS_FATAL_ERROR("--mpi needs ns-3 configured with --enable-mpi");
+#endif
+        NS_ABORT_MSG_IF(adaptive || flowmon_xml || trace_interval.IsStrictlyPositive() || benchmark ||
+                        !benchmark_sizes.empty() || validate_aggregation || fluid || validate_fluid,
+                        "--adaptive, --flowmonXml, --traceInterval, the benchmarks, the aggregation check and "
+                        "the fluid model do not work with --mpi");
+    }
 
-    // Create nodes and links
-    create_topology();
+    if (!benchmark_sizes.empty()) {
+        run_topology_benchmarks(benchmark_sizes, benchmark_bytes);
+        return 0;
+    }
+    size_topology();
 
-    // Configure network with point-to-point links, assigning IP addresses
-    configure_network(pointToPoint, address, i1, i2, i3, i4, i5);
-    
-    // Destination addresses 
-    Address destinationIP1 = InetSocketAddress(i4.GetAddress(1), d1_port);
-    Address destinationIP2 = InetSocketAddress(i5.GetAddress(1), d2_port);
-   
-    run_experiments(destinationIP1, destinationIP2);
+    if (spec_file.empty()) {
+        std::istringstream in(default_spec);
+        experiments = parse_spec(in);
+    } else {
+        std::ifstream in(spec_file);
+        NS_ABORT_MSG_IF(!in, "Cannot open spec file " << spec_file);
+        experiments = parse_spec(in);
+    }
+    if (runs > 0) {
+        for (ExperimentSpec& spec : experiments) {
+            spec.runs = runs;
+        }
+    }
+    if (sweep == "default") {
+        std::istringstream in(default_sweep);
+        experiments = expand_sweep(in, experiments);
+    } else if (!sweep.empty()) {
+        std::ifstream in(sweep);
+        NS_ABORT_MSG_IF(!in, "Cannot open sweep file " << sweep);
+        experiments = expand_sweep(in, experiments);
+    }
+    // Cells are stored by experiment name, two experiments of the same name would share them
+    std::set<std::string> names;
+    for (const ExperimentSpec& spec : experiments) {
+        NS_ABORT_MSG_IF(mpi && spec.workload.flows > 0, "Workloads do not work with --mpi");
+        NS_ABORT_MSG_IF(!names.insert(spec.name).second, "Experiment " << spec.name << " is defined twice");
+    }
 
-  
-    collect_and_analyze_data(tputsexp1, tputsexp2, tputs2exp2, tputsexp3, tputsexp4,
-                           tputs2exp4, tputsexp5, tputs2exp5, ftimeexp1, ftimeexp2,
-                           ftime2exp2, ftimeexp3, ftimeexp4, ftime2exp4, ftimeexp5,
-                           ftime2exp5);
-    calculate_statistics(tputsexp1, tputsexp2, tputs2exp2, tputsexp3, tputsexp4,
-                        tputs2exp4, tputsexp5, tputs2exp5, ftimeexp1, ftimeexp2,
-                        ftime2exp2, ftimeexp3, ftimeexp4, ftime2exp4, ftimeexp5,
-                        ftime2exp5, th_means, th_sds, afct_means, afct_sds);
-    write_output(tputsexp1, tputsexp2, tputs2exp2, tputsexp3, tputsexp4,
-                tputs2exp4, tputsexp5, tputs2exp5, ftimeexp1, ftimeexp2,
-                ftime2exp2, ftimeexp3, ftimeexp4, ftime2exp4, ftimeexp5,
-                ftime2exp5, th_means, th_sds, afct_means, afct_sds);
-
-    return 0;
+    // A non-zero exit status tells scripts that the scenario got slower
+    if (benchmark) {
+        return run_scheduler_benchmarks(schedulers, benchmark_baseline, benchmark_tolerance) > 0 ? 1 : 0;
+    }
+
+    // Likewise when the fast mode is off by more than the tolerance
+    if (validate_aggregation) {
+        return run_aggregation_validation(aggregation_tolerance) > 0 ? 1 : 0;
+    }
+
+    // And when the fluid model is off by more than its tolerance
+    if (validate_fluid) {
+        return run_fluid_validation(fluid_tolerance) > 0 ? 1 : 0;
+    }
+    if (fluid) {
+        run_fluid_experiments();
+        return 0;
+    }
+
+    // One row per flow per run and one summary per flow of each experiment
+    std::vector<FlowResult> results;
+    std::vector<FlowSummary> summaries;
+    QueueDelays delays;
+
+    // Each run builds its own network inside a worker process, or on all MPI ranks. Ranks other than 0
+    // only take part in the simulation. A distributed simulation exits with status 2 while runs are
+    // missing, the outputs are written by the mpirun that simulates the last one.
+    int status = 0;
+    if (mpi_rank != 0) {
+        run_cells_distributed([](const std::string&) {});
+    } else {
+        open_results_db();
+        uint32_t missing = collect_and_analyze_data(results, delays);
+        if (missing > 0) {
+            std::cout << missing << " runs left to simulate, start mpirun again" << std::endl;
+            status = 2;
+        } else {
+            calculate_statistics(results, summaries);
+            write_output(results, summaries);
+            write_statistics(summaries);
+            std::vector<std::vector<double>> fct_p99 = write_fct_percentiles();
+            write_queue_delays(delays);
+            if (!sweep.empty()) {
+                write_sweep_ranking(summaries, delays, fct_p99);
+            }
+        }
+        close_results_db();
+    }
+
+#ifdef NS3_MPI
+    if (mpi) {
+        MpiInterface::Disable();
+    }
+#endif
+
+    return status;
 }